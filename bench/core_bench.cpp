@@ -0,0 +1,95 @@
+/**
+ * Tokenization throughput benchmark, no database involved
+ *
+ * Usage: core_bench file [gram N] [other tokenizer options...]
+ *
+ * The whole file is tokenized as one document repeatedly, through both the callback and the buffer API.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ngram_core.h"
+
+typedef std::chrono::steady_clock clock_type;
+
+static int count_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+    (void) tflags, (void) pToken, (void) iStart, (void) iEnd;
+    *(long *) pCtx += nToken;
+    return NGRAM_CORE_OK;
+}
+
+static bool read_file(const char *path, std::string &text) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == nullptr) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+static void report(const char *name, size_t bytes, int iterations, clock_type::duration elapsed) {
+    double s = std::chrono::duration<double>(elapsed).count();
+    printf("%-10s iterations: %d  %.1f MiB/s\n", name, iterations, (double) bytes * iterations / s / (1 << 20));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file [tokenizer options...]\n", argv[0]);
+        return 1;
+    }
+
+    std::string text;
+    if (!read_file(argv[1], text)) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    ngram_core_config *cfg = ngram_core_config_new((const char **) argv + 2, argc - 2);
+    if (cfg == nullptr) {
+        fprintf(stderr, "invalid tokenizer options\n");
+        return 1;
+    }
+
+    const int iterations = std::max(1, (int) ((64 << 20) / std::max(text.size(), (size_t) 1)));
+    long sum = 0;
+    auto t0 = clock_type::now();
+    for (int i = 0; i < iterations; i++) {
+        if (ngram_core_tokenize(cfg, NGRAM_CORE_TOKENIZE_DOCUMENT, text.data(), (int) text.size(),
+                                &sum, count_cb, nullptr) != NGRAM_CORE_OK) {
+            fprintf(stderr, "tokenize error\n");
+            return 1;
+        }
+    }
+    report("callback", text.size(), iterations, clock_type::now() - t0);
+
+    // Size the buffers once, then reuse them
+    int nToken = 0;
+    int nBuf = 0;
+    (void) ngram_core_tokenize_buffer(cfg, NGRAM_CORE_TOKENIZE_DOCUMENT, text.data(), (int) text.size(),
+                                      nullptr, &nToken, nullptr, &nBuf);
+    std::vector<ngram_core_token> aToken(nToken);
+    std::vector<char> buf(nBuf);
+    t0 = clock_type::now();
+    for (int i = 0; i < iterations; i++) {
+        int n = (int) aToken.size();
+        int b = (int) buf.size();
+        if (ngram_core_tokenize_buffer(cfg, NGRAM_CORE_TOKENIZE_DOCUMENT, text.data(), (int) text.size(),
+                                       aToken.data(), &n, buf.data(), &b) != NGRAM_CORE_OK) {
+            fprintf(stderr, "tokenize error\n");
+            return 1;
+        }
+        sum += b;
+    }
+    report("buffer", text.size(), iterations, clock_type::now() - t0);
+
+    ngram_core_config_free(cfg);
+    return sum == 0;
+}
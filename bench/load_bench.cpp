@@ -0,0 +1,82 @@
+/**
+ * Connection open + extension load latency benchmark
+ *
+ * Usage: load_bench path/to/libngram.so [iterations]
+ *
+ * Each iteration opens an in-memory connection, loads the extension, creates an ngram FTS5 table and closes it.
+ *  An iteration without loading the extension is measured as the baseline.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "sqlite/sqlite3.h"
+
+typedef std::chrono::steady_clock clock_type;
+
+static bool open_and_load(const char *lib, bool load) {
+    sqlite3 *db = nullptr;
+    bool ok = sqlite3_open(":memory:", &db) == SQLITE_OK;
+
+    if (ok && load) {
+        char *zErr = nullptr;
+        ok = sqlite3_enable_load_extension(db, 1) == SQLITE_OK &&
+             sqlite3_load_extension(db, lib, "sqlite3_ngram_init", &zErr) == SQLITE_OK &&
+             sqlite3_exec(db, "CREATE VIRTUAL TABLE t1 USING fts5(x, tokenize = 'ngram')",
+                          nullptr, nullptr, &zErr) == SQLITE_OK;
+        if (!ok) {
+            fprintf(stderr, "error: %s\n", zErr != nullptr ? zErr : sqlite3_errmsg(db));
+        }
+        sqlite3_free(zErr);
+    }
+
+    sqlite3_close(db);
+    return ok;
+}
+
+static bool measure(const char *name, const char *lib, bool load, int iterations) {
+    std::vector<double> us;
+    us.reserve(iterations);
+
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = clock_type::now();
+        if (!open_and_load(lib, load)) {
+            return false;
+        }
+        auto t1 = clock_type::now();
+        us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (double v: us) sum += v;
+    printf("%-16s iterations: %d  mean: %.1f us  p50: %.1f us  p99: %.1f us\n",
+           name, iterations, sum / iterations, us[iterations / 2], us[iterations * 99 / 100]);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s path/to/libngram.so [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations should be a positive number\n");
+        return 1;
+    }
+
+    // Warm up the page cache and dynamic loader
+    if (!open_and_load(argv[1], true)) {
+        return 1;
+    }
+
+    if (!measure("open", argv[1], false, iterations) ||
+        !measure("open+load", argv[1], true, iterations)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+.load build/libngram.so
+-- sql/words.txt has "apple" and "人民", run from the repository root
+CREATE VIRTUAL TABLE t1 USING fts5(x, tokenize = 'ngram gram 2 dict ''sql/words.txt''');
+CREATE VIRTUAL TABLE t2 USING fts5(x, tokenize = 'ngram gram 2');
+INSERT INTO t1 VALUES('I like apple pie');
+INSERT INTO t2 VALUES('I like apple pie');
+INSERT INTO t1 VALUES('中华人民共和国');
+INSERT INTO t2 VALUES('中华人民共和国');
+
+-- Out-of-vocabulary words next to a dictionary word are indexed as on a plain ngram table
+-- The following queries all return 1
+SELECT (SELECT group_concat(rowid) FROM t1('like')) IS (SELECT group_concat(rowid) FROM t2('like'));
+SELECT (SELECT group_concat(rowid) FROM t1('pie')) IS (SELECT group_concat(rowid) FROM t2('pie'));
+SELECT (SELECT group_concat(rowid) FROM t1('apple')) IS (SELECT group_concat(rowid) FROM t2('apple'));
+SELECT (SELECT group_concat(rowid) FROM t1('中华')) IS (SELECT group_concat(rowid) FROM t2('中华'));
+SELECT (SELECT group_concat(rowid) FROM t1('共和国')) IS (SELECT group_concat(rowid) FROM t2('共和国'));
@@ -5,3 +5,15 @@ INSERT INTO t1 VALUES(' 2021 年 10 月，在 Ubuntu Linux 上如何使用WeChat
 --SELECT ngram_highlight(t1, 0, '[', ']') FROM t1('ubuntu linux上');
 SELECT ngram_highlight(t1, "0") FROM t1('ubuntu linux上');
 
+
+-- HTML escaping, the first special character is at or past a 16-byte chunk boundary
+CREATE VIRTUAL TABLE t2 USING fts5(x, tokenize = 'ngram gram 2');
+INSERT INTO t2 VALUES('abcdefghijklmno<p> Linux & "Ubuntu"');
+INSERT INTO t2 VALUES('abcdefghijklmnop<b>Linux</b> it''s');
+INSERT INTO t2 VALUES('abcdefghijklmnopq & Linux <上如何>');
+INSERT INTO t2 VALUES('abcdefghijklmnopqrstuvwxyz012345> Linux >abcdefghijklmnopqrstuvwxyz012345"');
+-- The following queries all return 1
+SELECT ngram_highlight(t2, 0, '[', ']', 'html')
+    = replace(replace(replace(replace(replace(ngram_highlight(t2, 0, '[', ']'),
+        '&', '&amp;'), '<', '&lt;'), '>', '&gt;'), '"', '&quot;'), '''', '&#39;')
+FROM t2('linux');
@@ -0,0 +1,14 @@
+.load build/libngram.so
+CREATE VIRTUAL TABLE t1 USING fts5(x, tokenize = 'ngram gram 2 json values');
+CREATE VIRTUAL TABLE t2 USING fts5(x, tokenize = 'ngram gram 2');
+INSERT INTO t1 VALUES('{"os": "Ubuntu Linux", "msg": "disk full", "city": "new york", "tags": [2021, "上如何使用WeChat"]}');
+-- Each value on its own, as a JSON table is expected to index them
+INSERT INTO t2 VALUES('Ubuntu Linux'), ('disk full'), ('new york'), ('2021'), ('上如何使用WeChat');
+CREATE VIRTUAL TABLE v1 USING fts5vocab(t1, row);
+CREATE VIRTUAL TABLE v2 USING fts5vocab(t2, row);
+
+-- The following queries all return 1
+SELECT (SELECT group_concat(term) FROM v1) IS (SELECT group_concat(term) FROM v2);
+SELECT count(*) FROM t1('linux');
+SELECT count(*) FROM t1('disk full');
+SELECT count(*) FROM t1('york');
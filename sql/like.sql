@@ -0,0 +1,23 @@
+.load build/libngram.so
+CREATE VIRTUAL TABLE t1 USING fts5(x, tokenize = 'ngram gram 2');
+INSERT INTO t1 VALUES(' 2021 年 10 月，在 Ubuntu Linux 上如何使用WeChat ？ 🤣🎃');
+INSERT INTO t1 VALUES('I like apple pie');
+INSERT INTO t1 VALUES('error: disk full');
+
+-- The last word of a text is indexed as well, thus ngram_like()/ngram_glob() agree with the built-in LIKE/GLOB
+-- The following queries all return 1
+SELECT (SELECT group_concat(id) FROM ngram_like('t1', 'x', '%apple pie%'))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE x LIKE '%apple pie%');
+SELECT (SELECT group_concat(id) FROM ngram_like('t1', 'x', 'I like apple pie'))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE x LIKE 'I like apple pie');
+SELECT (SELECT group_concat(id) FROM ngram_like('t1', 'x', '%disk full'))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE x LIKE '%disk full');
+SELECT (SELECT group_concat(id) FROM ngram_like('t1', 'x', '%ubuntu linux%'))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE x LIKE '%ubuntu linux%');
+SELECT (SELECT group_concat(id) FROM ngram_glob('t1', 'x', '*Linux 上如何*'))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE x GLOB '*Linux 上如何*');
+
+-- The following queries all match a single row
+SELECT * FROM t1('pie');
+SELECT * FROM t1('full');
+SELECT * FROM t1('apple pie');
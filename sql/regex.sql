@@ -0,0 +1,16 @@
+.load build/libngram.so
+CREATE VIRTUAL TABLE t1 USING fts5(x, tokenize = 'ngram gram 2');
+INSERT INTO t1 VALUES(' 2021 年 10 月，在 Ubuntu Linux 上如何使用WeChat ？ 🤣🎃');
+INSERT INTO t1 VALUES('I like apple pie');
+INSERT INTO t1 VALUES('error: disk full');
+
+-- The MATCH expression selects a superset of the rows matched by the regex, thus prefilter + verify equals a scan
+-- The following queries all return 1
+SELECT (SELECT group_concat(rowid) FROM t1 WHERE t1 MATCH ngram_regex_query('apple pie', 2) AND ngram_regexp('apple pie', x))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE ngram_regexp('apple pie', x));
+SELECT (SELECT group_concat(rowid) FROM t1 WHERE t1 MATCH ngram_regex_query('disk full', 2) AND ngram_regexp('disk full', x))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE ngram_regexp('disk full', x));
+SELECT (SELECT group_concat(rowid) FROM t1 WHERE t1 MATCH ngram_regex_query('^error: disk full$', 2) AND ngram_regexp('^error: disk full$', x))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE ngram_regexp('^error: disk full$', x));
+SELECT (SELECT group_concat(rowid) FROM t1 WHERE t1 MATCH ngram_regex_query('Linux (kernel|上如何)', 2) AND ngram_regexp('Linux (kernel|上如何)', x))
+    IS (SELECT group_concat(rowid) FROM t1 WHERE ngram_regexp('Linux (kernel|上如何)', x));
@@ -0,0 +1,156 @@
+#include "dict_segmenter.h"
+
+#include <cctype>
+#include <glog/logging.h>
+
+#include "ngram_core.h"
+#include "double_array_trie.h"
+#include "grapheme.h"
+#include "probes.h"
+
+namespace ngram_tokenizer {
+    DictSegmenter::DictSegmenter(const char *pText, int nText, const ngram_context_t *ctx, int max_tokens) {
+        CHECK_NOTNULL(pText);
+        CHECK_GE(nText, 0);
+        CHECK_NOTNULL(ctx);
+        CHECK_NOTNULL(ctx->dict);
+        CHECK_GE(max_tokens, 0);
+        this->pText = pText;
+        this->nText = nText;
+        this->ctx = ctx;
+        this->max_tokens = max_tokens;
+        this->gram_count = 0;
+        this->truncated = false;
+    }
+
+    static inline bool is_ascii_alnum(char c) {
+        return isalnum((unsigned char) c) != 0;
+    }
+
+    // A dictionary word may not start or end inside an ASCII alphanumeric run, e.g. "app" in "apple"
+    bool DictSegmenter::match_allowed(int i) const {
+        return i == 0 || !is_ascii_alnum(pText[i]) || !is_ascii_alnum(pText[i - 1]);
+    }
+
+    int DictSegmenter::char_length(int i) const {
+        if (ctx->grapheme) {
+            return grapheme_cluster_length(pText + i, nText - i);
+        }
+        unsigned int cp;
+        return utf8_decode(pText + i, nText - i, &cp);
+    }
+
+    typedef struct {
+        void *pCtx;
+        xTokenCallback xToken;
+        int iOff;   // Span offset within the whole input text
+    } span_callback_t;
+
+    static int span_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+        auto span = (span_callback_t *) pCtx;
+        return span->xToken(span->pCtx, tflags, pToken, nToken, iStart + span->iOff, iEnd + span->iOff);
+    }
+
+    // Tokenize the out-of-vocabulary span [iStart, iEnd) by n-gram, the span's last word is emitted as well
+    //  since GramStream only skips a trailing OTHER run covered by the previous gram
+    int DictSegmenter::flush(int iStart, int iEnd, void *pCtx, xTokenCallback xToken) {
+        if (iStart >= iEnd) {
+            return NGRAM_CORE_OK;
+        }
+
+        int budget = 0;
+        if (max_tokens != 0) {
+            budget = max_tokens - gram_count;
+            if (budget <= 0) {
+                truncated = true;
+                return NGRAM_CORE_DONE;
+            }
+        }
+
+        span_callback_t span = {pCtx, xToken, iStart};
+        GramStream gs(pText + iStart, iEnd - iStart, ctx, budget);
+        int rc = gs.run(&span, span_cb);
+        gram_count += gs.get_gram_count();
+        if (rc == NGRAM_CORE_OK && gs.is_truncated()) {
+            truncated = true;
+            rc = NGRAM_CORE_DONE;
+        }
+        return rc;
+    }
+
+    int DictSegmenter::emit_word(int iStart, int iEnd, void *pCtx, xTokenCallback xToken) {
+        if (max_tokens != 0 && gram_count >= max_tokens) {
+            truncated = true;
+            return NGRAM_CORE_DONE;
+        }
+
+        word.assign(pText + iStart, iEnd - iStart);
+        if (!ctx->case_sensitive) {
+            for (auto &c: word) {
+                c = (char) tolower((unsigned char) c);
+            }
+        }
+
+        DLOG(INFO) << "> dict token = '" << word << "'"
+                   << " iStart = " << iStart
+                   << " iEnd = " << iEnd;
+        gram_count++;
+        NGRAM_PROBE6(gram, (int) word.length(), 0, iStart, iEnd, NGRAM_PROBE_WORD, 0);
+        return xToken(pCtx, 0, word.c_str(), (int) word.length(), iStart, iEnd);
+    }
+
+    /**
+     * @return  same as GramStream::run()
+     */
+    int DictSegmenter::run(void *pCtx, xTokenCallback xToken) {
+        CHECK_NOTNULL(xToken);
+
+        const DoubleArrayTrie *dict = ctx->dict;
+        int rc = NGRAM_CORE_OK;
+        int spanStart = 0;
+        int i = 0;
+
+        while (rc == NGRAM_CORE_OK && i < nText) {
+            int len = 0;
+            if (match_allowed(i)) {
+                len = dict->longest_prefix(pText + i, nText - i, [this, i](int n) {
+                    int end = i + n;
+                    // Must end at a character boundary and not inside an ASCII alphanumeric run
+                    return end == nText || ((pText[end] & 0xC0) != 0x80 && match_allowed(end));
+                });
+            }
+
+            if (len > 0) {
+                rc = flush(spanStart, i, pCtx, xToken);
+                if (rc == NGRAM_CORE_OK) {
+                    rc = emit_word(i, i + len, pCtx, xToken);
+                }
+                i += len;
+                spanStart = i;
+            } else {
+                int n = char_length(i);
+                if (n <= 0) {
+                    LOG(ERROR) << "Met non-UTF8 character at index " << i;
+                    return NGRAM_CORE_ERROR;
+                }
+                i += n;
+            }
+        }
+
+        if (rc == NGRAM_CORE_OK) {
+            rc = flush(spanStart, nText, pCtx, xToken);
+        }
+        if (rc == NGRAM_CORE_DONE && truncated) {
+            rc = NGRAM_CORE_OK;
+        }
+        return rc;
+    }
+
+    bool DictSegmenter::is_truncated() const {
+        return truncated;
+    }
+
+    int DictSegmenter::get_gram_count() const {
+        return gram_count;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+
+#include "ngram_context.h"
+#include "gram_stream.h"
+
+namespace ngram_tokenizer {
+    /**
+     * Dictionary segmenter
+     *  Emit the longest dictionary words(forward maximum matching),
+     *  out-of-vocabulary spans fall back to GramStream.
+     */
+    class DictSegmenter {
+    public:
+        DictSegmenter(const char *, int, const ngram_context_t *, int);
+
+        int run(void *, xTokenCallback);
+
+        bool is_truncated() const;
+
+        int get_gram_count() const;
+
+    private:
+        bool match_allowed(int) const;
+
+        int char_length(int) const;
+
+        int flush(int, int, void *, xTokenCallback);
+
+        int emit_word(int, int, void *, xTokenCallback);
+
+        const char *pText;
+        int nText;
+        const ngram_context_t *ctx;
+        int max_tokens;     // 0 means unlimited
+
+        std::string word;   // Reusable word buffer
+        int gram_count;
+        bool truncated;
+    };
+}
@@ -0,0 +1,234 @@
+#include "double_array_trie.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DAT_MAGIC       "NGRAMDA1"
+#define DAT_MAGIC_LEN   8
+#define FREE_CHECK      (-1)
+#define ROOT_CHECK      (-2)
+
+namespace ngram_tokenizer {
+    typedef struct {
+        char magic[DAT_MAGIC_LEN];
+        uint64_t size;  // Unit count
+    } dat_header_t;
+
+    DoubleArrayTrie::DoubleArrayTrie() {
+        this->units = nullptr;
+        this->size = 0;
+        this->mapped = nullptr;
+        this->mapped_size = 0;
+        this->next_check_pos = 0;
+    }
+
+    DoubleArrayTrie::~DoubleArrayTrie() {
+        reset();
+    }
+
+    void DoubleArrayTrie::reset() {
+        if (mapped != nullptr) {
+            int e = munmap(mapped, mapped_size);
+            CHECK_EQ(e, 0);
+            mapped = nullptr;
+            mapped_size = 0;
+        }
+        array.clear();
+        units = nullptr;
+        size = 0;
+    }
+
+    size_t DoubleArrayTrie::get_size() const {
+        return size;
+    }
+
+    /**
+     * Place children of the node s, words[lo, hi) share the same prefix of length depth
+     */
+    bool DoubleArrayTrie::insert(const std::vector<std::string> &words, size_t lo, size_t hi, size_t depth, int32_t s) {
+        // Collect distinct child codes, words are sorted thus equal codes are adjacent
+        std::vector<std::pair<size_t, size_t>> children;    // (code, first word index)
+        for (size_t i = lo; i < hi; i++) {
+            const auto &w = words[i];
+            size_t c = depth < w.size() ? code((unsigned char) w[depth]) : 0;
+            if (children.empty() || children.back().first != c) {
+                children.emplace_back(c, i);
+            }
+        }
+        CHECK(!children.empty());
+
+        // Find a base that all child slots are free
+        size_t first = children.front().first;
+        size_t pos = std::max(next_check_pos, first + 1);
+        size_t base;
+        bool dense = true;
+        for (;; pos++) {
+            if (pos >= array.size()) {
+                array.resize(pos + 1, unit_t{0, FREE_CHECK});
+            }
+            if (array[pos].check != FREE_CHECK) {
+                continue;
+            }
+            if (dense) {
+                // Every slot before pos is occupied, skip them in subsequent searches
+                next_check_pos = pos;
+                dense = false;
+            }
+
+            base = pos - first;
+            bool ok = true;
+            for (const auto &child: children) {
+                size_t t = base + child.first;
+                if (t < array.size() && array[t].check != FREE_CHECK) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (ok) {
+                break;
+            }
+        }
+
+        if (base + children.back().first > INT32_MAX) {
+            LOG(ERROR) << "Double-array trie overflow";
+            return false;
+        }
+        if (base + children.back().first >= array.size()) {
+            array.resize(base + children.back().first + 1, unit_t{0, FREE_CHECK});
+        }
+
+        array[s].base = (int32_t) base;
+        for (const auto &child: children) {
+            array[base + child.first].check = s;
+        }
+
+        for (size_t k = 0; k < children.size(); k++) {
+            size_t c = children[k].first;
+            if (c == 0) {
+                // Terminal, a word ends at depth
+                array[base].base = 0;
+                continue;
+            }
+            size_t end = k + 1 < children.size() ? children[k + 1].second : hi;
+            if (!insert(words, children[k].second, end, depth + 1, (int32_t) (base + c))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool DoubleArrayTrie::build(std::vector<std::string> words) {
+        reset();
+
+        for (auto &w: words) {
+            for (auto &c: w) {
+                c = (char) (code((unsigned char) c) - 1);
+            }
+        }
+        words.erase(std::remove(words.begin(), words.end(), std::string()), words.end());
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+
+        array.assign(1, unit_t{0, ROOT_CHECK});
+        next_check_pos = 1;
+        if (!words.empty() && !insert(words, 0, words.size(), 0, 0)) {
+            reset();
+            return false;
+        }
+
+        units = array.data();
+        size = array.size();
+        DLOG(INFO) << "Built double-array trie, words: " << words.size() << " units: " << size;
+        return true;
+    }
+
+    /**
+     * Load a dictionary file
+     *  A prebuilt double-array file(see save()) is mmap(2)-ed directly,
+     *  otherwise the file is treated as a word list, one word per line.
+     */
+    bool DoubleArrayTrie::load(const char *path) {
+        CHECK_NOTNULL(path);
+        reset();
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOG(ERROR) << "open() fail, path: " << path << " errno: " << errno;
+            return false;
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            LOG(ERROR) << "fstat() fail or empty file, path: " << path;
+            (void) close(fd);
+            return false;
+        }
+
+        void *p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        (void) close(fd);
+        if (p == MAP_FAILED) {
+            LOG(ERROR) << "mmap() fail, path: " << path << " errno: " << errno;
+            return false;
+        }
+        mapped = p;
+        mapped_size = (size_t) st.st_size;
+
+        auto header = (const dat_header_t *) p;
+        if (mapped_size >= sizeof(*header) && !memcmp(header->magic, DAT_MAGIC, DAT_MAGIC_LEN)) {
+            if (header->size == 0 || mapped_size != sizeof(*header) + header->size * sizeof(unit_t)) {
+                LOG(ERROR) << "Corrupted double-array file: " << path;
+                reset();
+                return false;
+            }
+            units = (const unit_t *) (header + 1);
+            size = (size_t) header->size;
+            DLOG(INFO) << "Mapped double-array trie " << path << " units: " << size;
+            return true;
+        }
+
+        std::vector<std::string> words;
+        const char *s = (const char *) p;
+        const char *end = s + mapped_size;
+        while (s < end) {
+            auto e = (const char *) memchr(s, '\n', end - s);
+            if (e == nullptr) e = end;
+            const char *w = e;
+            while (w > s && (w[-1] == '\r' || w[-1] == ' ' || w[-1] == '\t')) w--;
+            if (w > s) {
+                words.emplace_back(s, w - s);
+            }
+            s = e + 1;
+        }
+
+        reset();
+        return build(std::move(words));
+    }
+
+    bool DoubleArrayTrie::save(const char *path) const {
+        CHECK_NOTNULL(path);
+
+        FILE *fp = fopen(path, "wb");
+        if (fp == nullptr) {
+            LOG(ERROR) << "fopen() fail, path: " << path << " errno: " << errno;
+            return false;
+        }
+
+        dat_header_t header{};
+        memcpy(header.magic, DAT_MAGIC, DAT_MAGIC_LEN);
+        header.size = size;
+        bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                  fwrite(units, sizeof(unit_t), size, fp) == size;
+        ok = fclose(fp) == 0 && ok;
+        if (!ok) {
+            LOG(ERROR) << "Cannot write double-array file: " << path;
+        }
+        return ok;
+    }
+}
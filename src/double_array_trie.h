@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ngram_tokenizer {
+    /**
+     * Byte-wise double-array trie
+     *  ASCII letters are matched case-insensitively(words are lower-cased when building).
+     *
+     * see:
+     *  https://linux.thai.net/~thep/datrie/datrie.html
+     *  http://chasen.org/~taku/software/darts/
+     */
+    class DoubleArrayTrie {
+    public:
+        DoubleArrayTrie();
+
+        ~DoubleArrayTrie();
+
+        DoubleArrayTrie(const DoubleArrayTrie &) = delete;
+
+        DoubleArrayTrie &operator=(const DoubleArrayTrie &) = delete;
+
+        bool build(std::vector<std::string>);
+
+        bool load(const char *);
+
+        bool save(const char *) const;
+
+        size_t get_size() const;
+
+        /**
+         * Find the longest word which is a prefix of p[0, n)
+         *
+         * @accept  predicate accept(len) to filter match candidates, e.g. reject the ones not ending at character boundary
+         * @return  length in bytes of the longest accepted word, 0 if none
+         */
+        template<typename Accept>
+        int longest_prefix(const char *p, int n, Accept accept) const {
+            int best = 0;
+            int32_t s = 0;
+
+            for (int i = 0; ; i++) {
+                // Terminal(code 0) child marks a word ends here
+                auto t = (size_t) units[s].base;
+                if (i != 0 && t < size && units[t].check == s && accept(i)) {
+                    best = i;
+                }
+                if (i >= n) {
+                    break;
+                }
+
+                t += code((unsigned char) p[i]);
+                if (t >= size || units[t].check != s) {
+                    break;
+                }
+                s = (int32_t) t;
+            }
+            return best;
+        }
+
+    private:
+        typedef struct {
+            int32_t base;
+            int32_t check;
+        } unit_t;
+
+        static size_t code(unsigned char c) {
+            return (size_t) ((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c) + 1;
+        }
+
+        bool insert(const std::vector<std::string> &, size_t, size_t, size_t, int32_t);
+
+        void reset();
+
+        const unit_t *units;
+        size_t size;
+
+        std::vector<unit_t> array;  // Backing storage when built in memory
+        void *mapped;               // Backing storage when loaded by mmap(2)
+        size_t mapped_size;
+        size_t next_check_pos;      // Build-time search hint
+    };
+}
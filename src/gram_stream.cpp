@@ -0,0 +1,184 @@
+#include "gram_stream.h"
+
+#include <cctype>
+#include <glog/logging.h>
+
+#include "ngram_core.h"
+#include "probes.h"
+
+namespace ngram_tokenizer {
+    GramStream::GramStream(const char *pText, int nText, const ngram_context_t *ctx, int max_tokens)
+            : tv(pText, nText, CHECK_NOTNULL(ctx)->grapheme) {
+        CHECK_GE(ctx->ngram, MIN_GRAM);
+        CHECK_LE(ctx->ngram, MAX_GRAM);
+        CHECK_GE(max_tokens, 0);
+        this->ngram = ctx->ngram;
+        this->case_sensitive = ctx->case_sensitive;
+        this->max_tokens = max_tokens;
+        this->base = 0;
+        this->eof = false;
+        this->failed = false;
+        this->gram_count = 0;
+        this->truncated = false;
+    }
+
+    // Pull tokens until the token at index i is in the window, return false if the input is exhausted before that
+    bool GramStream::available(size_t i) {
+        CHECK_GE(i, base);
+        while (!eof && i >= base + window.size()) {
+            Token token;
+            int rc = tv.next(token);
+            if (rc > 0) {
+                window.emplace_back(std::move(token));
+            } else {
+                failed = rc < 0;
+                eof = true;
+            }
+        }
+        return i < base + window.size();
+    }
+
+    const Token &GramStream::at(size_t i) const {
+        CHECK_GE(i, base);
+        CHECK_LT(i, base + window.size());
+        return window[i - base];
+    }
+
+    int GramStream::emit(const std::vector<Token> &arr, size_t last_index, void *pCtx, xTokenCallback xToken) {
+        if (max_tokens != 0 && gram_count >= max_tokens) {
+            truncated = true;
+            return NGRAM_CORE_DONE;
+        }
+
+        int iStart = arr[0].get_iStart();
+        int iEnd = arr[last_index].get_iEnd();
+        CHECK_LT(iStart, iEnd);
+
+        gram.clear();
+        for (size_t i = 0; i <= last_index; i++) {
+            gram += arr[i].get_str();
+        }
+
+        if (!case_sensitive) {
+            for (auto &c: gram) {
+                c = (char) tolower((unsigned char) c);
+            }
+        }
+
+        DLOG(INFO) << "> result token = '" << gram << "'"
+                   << " iStart = " << iStart
+                   << " iEnd = " << iEnd;
+        gram_count++;
+        NGRAM_PROBE6(gram, (int) gram.length(), (int) last_index + 1, iStart, iEnd, NGRAM_PROBE_GRAM, 0);
+        return xToken(pCtx, 0, gram.c_str(), (int) gram.length(), iStart, iEnd);
+    }
+
+    /**
+     * Generate n-grams and feed them into xToken()
+     *
+     * @return  NGRAM_CORE_OK if the input is exhausted or the max_tokens budget is reached,
+     *          NGRAM_CORE_ERROR if met non-UTF8 character,
+     *          otherwise the first non-NGRAM_CORE_OK value returned by xToken().
+     */
+    int GramStream::run(void *pCtx, xTokenCallback xToken) {
+        CHECK_NOTNULL(xToken);
+
+        const auto n = (size_t) ngram;
+        std::vector<Token> prevArr;
+        std::vector<Token> arr;
+
+        for (size_t i = 0; available(i); i++) {
+            arr.clear();
+
+            token_category_t prev_category = OTHER;
+            for (size_t j = 0; j < n; j++) {
+                // Avoid out of array boundary
+                if (!available(i + j)) {
+                    // Input exhausted, thus the total token count is known now
+                    size_t size = base + window.size();
+                    if (size >= n) {
+                        bool same_category = true;
+
+                        for (size_t k = 0; k < n; k++) {
+                            token_category_t category = at(size - k - 1).get_category();
+                            // Only OTHER tokens join into multi-token grams, a trailing word/number/punctuation
+                            //  is a gram on its own and never covered by the previous one
+                            if (category != OTHER || (k != 0 && category != prev_category)) {
+                                same_category = false;
+                                break;
+                            }
+                            prev_category = category;
+                        }
+
+                        // Same category meaning previously last ngram token had been added
+                        // Thus we don't need to cut again(unless they're in different categories)
+                        if (same_category) {
+                            DLOG(INFO)
+                                    << "Don't do tokenize for the last N non-complete terms since they're in a same category";
+                            arr.clear();
+                        }
+                    }
+
+                    break;
+                }
+
+                const auto &curr_token = at(i + j);
+
+                if (j != 0) {
+                    if (curr_token.get_category() != OTHER) {
+                        break;
+                    }
+                    if (curr_token.get_category() != prev_category) {
+                        break;
+                    }
+                }
+
+                arr.emplace_back(curr_token);
+                prev_category = curr_token.get_category();
+            }
+
+            if (!arr.empty()) {
+                int rc = NGRAM_CORE_OK;
+
+                // Temporarily solution to the input text case 'Hello世界'
+                if (prevArr.size() == 1 && prevArr[0].get_category() != OTHER &&
+                    arr[0].get_category() == OTHER) {
+                    for (size_t u = 0; rc == NGRAM_CORE_OK && u + 1 < arr.size(); u++) {
+                        DLOG(INFO) << "--- " << (u + 1);
+                        for (size_t v = 0; rc == NGRAM_CORE_OK && v <= u; v++) {
+                            rc = emit(arr, v, pCtx, xToken);
+                        }
+                    }
+                }
+
+                if (rc == NGRAM_CORE_OK) {
+                    rc = emit(arr, arr.size() - 1, pCtx, xToken);
+                }
+                if (rc == NGRAM_CORE_DONE && truncated) {
+                    return NGRAM_CORE_OK;
+                }
+                if (rc != NGRAM_CORE_OK) {
+                    return rc;
+                }
+
+                prevArr.swap(arr);
+            }
+
+            // Keep the last (N - 1) tokens for the trailing same category check
+            while (base + n <= i + 1 && !window.empty()) {
+                window.pop_front();
+                base++;
+            }
+        }
+
+        return failed ? NGRAM_CORE_ERROR : NGRAM_CORE_OK;
+    }
+
+    bool GramStream::is_truncated() const {
+        return truncated;
+    }
+
+    int GramStream::get_gram_count() const {
+        return gram_count;
+    }
+}
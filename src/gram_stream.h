@@ -0,0 +1,56 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ngram_context.h"
+#include "token_vector.h"
+
+namespace ngram_tokenizer {
+    typedef int (*xTokenCallback)(
+            void *pCtx,         /* Copy of 2nd argument to xTokenize() */
+            int tflags,         /* Mask of FTS5_TOKEN_* flags */
+            const char *pToken, /* Pointer to buffer containing token */
+            int nToken,         /* Size of token in bytes */
+            int iStart,         /* Byte offset of token within input text */
+            int iEnd            /* Byte offset of end of token within input text */
+    );
+
+    /**
+     * Streaming n-gram generator
+     *  Tokens are pulled lazily from a TokenVector and only a sliding window of (2N - 1) tokens is kept,
+     *  so memory usage no longer scales with the input length.
+     */
+    class GramStream {
+    public:
+        GramStream(const char *, int, const ngram_context_t *, int);
+
+        int run(void *, xTokenCallback);
+
+        bool is_truncated() const;
+
+        int get_gram_count() const;
+
+    private:
+        bool available(size_t);
+
+        const Token &at(size_t) const;
+
+        int emit(const std::vector<Token> &, size_t, void *, xTokenCallback);
+
+        TokenVector tv;
+        int ngram;
+        bool case_sensitive;
+        int max_tokens;     // 0 means unlimited
+
+        std::deque<Token> window;
+        size_t base;        // Token index of window.front()
+        bool eof;
+        bool failed;
+
+        std::string gram;   // Reusable gram buffer
+        int gram_count;
+        bool truncated;
+    };
+}
@@ -0,0 +1,281 @@
+#include "grapheme.h"
+
+#include <cstddef>
+#include <glog/logging.h>
+
+// Extended grapheme cluster segmentation
+// see:
+//  https://www.unicode.org/reports/tr29/#Grapheme_Cluster_Boundary_Rules
+//  https://www.unicode.org/Public/UCD/latest/ucd/auxiliary/GraphemeBreakProperty.txt
+//  https://www.unicode.org/Public/UCD/latest/ucd/emoji/emoji-data.txt
+//
+// Only the break properties which matter for the ngram tokenizer are tabulated:
+//  combining marks, joiners, variation selectors, emoji modifiers/tags, regional indicators,
+//  Extended_Pictographic and Hangul jamo. Prepend and Indic conjunct rules are not implemented.
+
+namespace ngram_tokenizer {
+    typedef enum {
+        GB_OTHER,
+        GB_EXTEND,          /* Grapheme_Extend + SpacingMark, both never break before(GB9, GB9a) */
+        GB_ZWJ,
+        GB_REGIONAL_INDICATOR,
+        GB_PICTOGRAPHIC,    /* Extended_Pictographic */
+        GB_L,
+        GB_V,
+        GB_T,
+        GB_LV,
+        GB_LVT,
+    } gb_property_t;
+
+    typedef struct {
+        unsigned int first;
+        unsigned int last;  /* Inclusive */
+        unsigned char property;
+    } gb_range_t;
+
+    // Must be sorted by code point and non-overlapping
+    static const gb_range_t gb_table[] = {
+            {0x00A9,  0x00A9,  GB_PICTOGRAPHIC},
+            {0x00AE,  0x00AE,  GB_PICTOGRAPHIC},
+            {0x0300,  0x036F,  GB_EXTEND},
+            {0x0483,  0x0489,  GB_EXTEND},
+            {0x0591,  0x05BD,  GB_EXTEND},
+            {0x05BF,  0x05BF,  GB_EXTEND},
+            {0x05C1,  0x05C2,  GB_EXTEND},
+            {0x05C4,  0x05C5,  GB_EXTEND},
+            {0x05C7,  0x05C7,  GB_EXTEND},
+            {0x0610,  0x061A,  GB_EXTEND},
+            {0x064B,  0x065F,  GB_EXTEND},
+            {0x0670,  0x0670,  GB_EXTEND},
+            {0x06D6,  0x06DC,  GB_EXTEND},
+            {0x06DF,  0x06E4,  GB_EXTEND},
+            {0x06E7,  0x06E8,  GB_EXTEND},
+            {0x06EA,  0x06ED,  GB_EXTEND},
+            {0x0900,  0x0903,  GB_EXTEND},
+            {0x093A,  0x093C,  GB_EXTEND},
+            {0x093E,  0x094F,  GB_EXTEND},
+            {0x0951,  0x0957,  GB_EXTEND},
+            {0x0962,  0x0963,  GB_EXTEND},
+            {0x0E31,  0x0E31,  GB_EXTEND},
+            {0x0E33,  0x0E3A,  GB_EXTEND},
+            {0x0E47,  0x0E4E,  GB_EXTEND},
+            {0x0EB1,  0x0EB1,  GB_EXTEND},
+            {0x0EB3,  0x0EBC,  GB_EXTEND},
+            {0x0EC8,  0x0ECD,  GB_EXTEND},
+            {0x1100,  0x115F,  GB_L},
+            {0x1160,  0x11A7,  GB_V},
+            {0x11A8,  0x11FF,  GB_T},
+            {0x1AB0,  0x1AFF,  GB_EXTEND},
+            {0x1DC0,  0x1DFF,  GB_EXTEND},
+            {0x200C,  0x200C,  GB_EXTEND},
+            {0x200D,  0x200D,  GB_ZWJ},
+            {0x203C,  0x203C,  GB_PICTOGRAPHIC},
+            {0x2049,  0x2049,  GB_PICTOGRAPHIC},
+            {0x20D0,  0x20FF,  GB_EXTEND},
+            {0x2122,  0x2122,  GB_PICTOGRAPHIC},
+            {0x2139,  0x2139,  GB_PICTOGRAPHIC},
+            {0x2194,  0x2199,  GB_PICTOGRAPHIC},
+            {0x21A9,  0x21AA,  GB_PICTOGRAPHIC},
+            {0x231A,  0x231B,  GB_PICTOGRAPHIC},
+            {0x2328,  0x2328,  GB_PICTOGRAPHIC},
+            {0x2388,  0x2388,  GB_PICTOGRAPHIC},
+            {0x23CF,  0x23CF,  GB_PICTOGRAPHIC},
+            {0x23E9,  0x23F3,  GB_PICTOGRAPHIC},
+            {0x23F8,  0x23FA,  GB_PICTOGRAPHIC},
+            {0x24C2,  0x24C2,  GB_PICTOGRAPHIC},
+            {0x25AA,  0x25AB,  GB_PICTOGRAPHIC},
+            {0x25B6,  0x25B6,  GB_PICTOGRAPHIC},
+            {0x25C0,  0x25C0,  GB_PICTOGRAPHIC},
+            {0x25FB,  0x25FE,  GB_PICTOGRAPHIC},
+            {0x2600,  0x27BF,  GB_PICTOGRAPHIC},
+            {0x2934,  0x2935,  GB_PICTOGRAPHIC},
+            {0x2B05,  0x2B07,  GB_PICTOGRAPHIC},
+            {0x2B1B,  0x2B1C,  GB_PICTOGRAPHIC},
+            {0x2B50,  0x2B50,  GB_PICTOGRAPHIC},
+            {0x2B55,  0x2B55,  GB_PICTOGRAPHIC},
+            {0x2CEF,  0x2CF1,  GB_EXTEND},
+            {0x2DE0,  0x2DFF,  GB_EXTEND},
+            {0x302A,  0x302F,  GB_EXTEND},
+            {0x3030,  0x3030,  GB_PICTOGRAPHIC},
+            {0x303D,  0x303D,  GB_PICTOGRAPHIC},
+            {0x3099,  0x309A,  GB_EXTEND},
+            {0x3297,  0x3297,  GB_PICTOGRAPHIC},
+            {0x3299,  0x3299,  GB_PICTOGRAPHIC},
+            {0xA960,  0xA97C,  GB_L},
+            {0xD7B0,  0xD7C6,  GB_V},
+            {0xD7CB,  0xD7FB,  GB_T},
+            {0xFE00,  0xFE0F,  GB_EXTEND},
+            {0xFE20,  0xFE2F,  GB_EXTEND},
+            {0xFF9E,  0xFF9F,  GB_EXTEND},
+            {0x1F000, 0x1F0FF, GB_PICTOGRAPHIC},
+            {0x1F10D, 0x1F10F, GB_PICTOGRAPHIC},
+            {0x1F12F, 0x1F12F, GB_PICTOGRAPHIC},
+            {0x1F16C, 0x1F171, GB_PICTOGRAPHIC},
+            {0x1F17E, 0x1F17F, GB_PICTOGRAPHIC},
+            {0x1F18E, 0x1F18E, GB_PICTOGRAPHIC},
+            {0x1F191, 0x1F19A, GB_PICTOGRAPHIC},
+            {0x1F1AD, 0x1F1E5, GB_PICTOGRAPHIC},
+            {0x1F1E6, 0x1F1FF, GB_REGIONAL_INDICATOR},
+            {0x1F201, 0x1F20F, GB_PICTOGRAPHIC},
+            {0x1F21A, 0x1F21A, GB_PICTOGRAPHIC},
+            {0x1F22F, 0x1F22F, GB_PICTOGRAPHIC},
+            {0x1F232, 0x1F23A, GB_PICTOGRAPHIC},
+            {0x1F23C, 0x1F23F, GB_PICTOGRAPHIC},
+            {0x1F249, 0x1F3FA, GB_PICTOGRAPHIC},
+            {0x1F3FB, 0x1F3FF, GB_EXTEND},      /* Emoji modifiers(skin tones) */
+            {0x1F400, 0x1F53D, GB_PICTOGRAPHIC},
+            {0x1F546, 0x1F64F, GB_PICTOGRAPHIC},
+            {0x1F680, 0x1F6FF, GB_PICTOGRAPHIC},
+            {0x1F774, 0x1F77F, GB_PICTOGRAPHIC},
+            {0x1F7D5, 0x1F7FF, GB_PICTOGRAPHIC},
+            {0x1F80C, 0x1F80F, GB_PICTOGRAPHIC},
+            {0x1F848, 0x1F84F, GB_PICTOGRAPHIC},
+            {0x1F85A, 0x1F85F, GB_PICTOGRAPHIC},
+            {0x1F888, 0x1F88F, GB_PICTOGRAPHIC},
+            {0x1F8AE, 0x1F8FF, GB_PICTOGRAPHIC},
+            {0x1F90C, 0x1F93A, GB_PICTOGRAPHIC},
+            {0x1F93C, 0x1F945, GB_PICTOGRAPHIC},
+            {0x1F947, 0x1FAFF, GB_PICTOGRAPHIC},
+            {0x1FC00, 0x1FFFD, GB_PICTOGRAPHIC},
+            {0xE0020, 0xE007F, GB_EXTEND},      /* Tags, e.g. subdivision flags */
+            {0xE0100, 0xE01EF, GB_EXTEND},
+    };
+
+    static gb_property_t gb_property(unsigned int cp) {
+        // Fast path: ASCII and CJK ideographs never take part in a cluster rule
+        if (cp < 0xA9 || (cp >= 0x3400 && cp < 0xA960)) {
+            return GB_OTHER;
+        }
+
+        // Precomposed Hangul syllables
+        if (cp >= 0xAC00 && cp <= 0xD7A3) {
+            return (cp - 0xAC00) % 28 == 0 ? GB_LV : GB_LVT;
+        }
+
+        size_t lo = 0;
+        size_t hi = sizeof(gb_table) / sizeof(gb_table[0]);
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cp < gb_table[mid].first) {
+                hi = mid;
+            } else if (cp > gb_table[mid].last) {
+                lo = mid + 1;
+            } else {
+                return (gb_property_t) gb_table[mid].property;
+            }
+        }
+        return GB_OTHER;
+    }
+
+    /**
+     * Decode one UTF-8 character
+     *
+     * @cp      where to store the decoded code point
+     * @return  bytes consumed, 0 if the input is empty or malformed
+     */
+    int utf8_decode(const char *p, int n, unsigned int *cp) {
+        if (n <= 0) {
+            return 0;
+        }
+
+        auto c = (unsigned char) p[0];
+        int len;
+        if (c < 0x80) {
+            *cp = c;
+            return 1;
+        } else if ((c & 0xE0) == 0xC0) {
+            len = 2;
+            *cp = c & 0x1F;
+        } else if ((c & 0xF0) == 0xE0) {
+            len = 3;
+            *cp = c & 0x0F;
+        } else if ((c & 0xF8) == 0xF0) {
+            len = 4;
+            *cp = c & 0x07;
+        } else {
+            return 0;
+        }
+
+        if (len > n) {
+            return 0;
+        }
+        for (int i = 1; i < len; i++) {
+            c = (unsigned char) p[i];
+            if ((c & 0xC0) != 0x80) {
+                return 0;
+            }
+            *cp = (*cp << 6) | (c & 0x3F);
+        }
+        return len;
+    }
+
+    /**
+     * Get byte length of the extended grapheme cluster starting at pText[0]
+     *  i.e. the first character plus all following characters that may not be broken from it.
+     *
+     * @return  0 if pText[0] is not a valid UTF-8 character
+     */
+    int grapheme_cluster_length(const char *pText, int nText) {
+        unsigned int cp;
+        int len = utf8_decode(pText, nText, &cp);
+        if (len <= 0) {
+            return 0;
+        }
+
+        gb_property_t prev = gb_property(cp);
+        bool pictographic_seen = prev == GB_PICTOGRAPHIC;   /* GB11: \p{ExtPict} Extend* ZWJ × \p{ExtPict} */
+        int ri_count = prev == GB_REGIONAL_INDICATOR;       /* GB12, GB13 */
+
+        while (len < nText) {
+            int n = utf8_decode(pText + len, nText - len, &cp);
+            if (n <= 0) {
+                break;
+            }
+
+            gb_property_t curr = gb_property(cp);
+            bool join;
+            switch (curr) {
+                case GB_EXTEND:
+                case GB_ZWJ:
+                    join = true;    /* GB9, GB9a */
+                    break;
+                case GB_PICTOGRAPHIC:
+                    join = prev == GB_ZWJ && pictographic_seen;
+                    break;
+                case GB_REGIONAL_INDICATOR:
+                    join = prev == GB_REGIONAL_INDICATOR && ri_count % 2 == 1;
+                    break;
+                case GB_L:
+                    join = prev == GB_L;
+                    break;
+                case GB_V:
+                case GB_LV:
+                case GB_LVT:
+                    join = prev == GB_L || (curr == GB_V && (prev == GB_LV || prev == GB_V));
+                    break;
+                case GB_T:
+                    join = prev == GB_LV || prev == GB_V || prev == GB_LVT || prev == GB_T;
+                    break;
+                default:
+                    join = false;
+                    break;
+            }
+            if (!join) {
+                break;
+            }
+
+            if (curr == GB_PICTOGRAPHIC) {
+                pictographic_seen = true;
+            } else if (curr == GB_REGIONAL_INDICATOR) {
+                ri_count++;
+            } else if (curr != GB_EXTEND && curr != GB_ZWJ) {
+                pictographic_seen = false;
+            }
+            prev = curr;
+            len += n;
+        }
+
+        DCHECK_LE(len, nText);
+        return len;
+    }
+}
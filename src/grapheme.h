@@ -0,0 +1,7 @@
+#pragma once
+
+namespace ngram_tokenizer {
+    int utf8_decode(const char *, int, unsigned int *);
+
+    int grapheme_cluster_length(const char *, int);
+}
@@ -1,9 +1,15 @@
 #include <cstring>
 #include <glog/logging.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "highlight.h"
 #include "utils.h"
+#include "probes.h"
+#ifdef NGRAM_PROTOBUF_HIGHLIGHT
 #include "proto/highlight_result.pb.h"
+#endif
 
 SQLITE_EXTENSION_INIT3
 
@@ -101,8 +107,87 @@ struct HighlightContext {
     int nIn;            /* Size of input text in bytes */
     int iOff;           /* Current offset within zIn[] */
     char *zOut;         /* Output value */
+    bool escape;        /* HTML-escape text copied from zIn[], markers are copied verbatim */
 };
 
+/*
+** Return the length of the longest prefix of z[0..n) without any of the
+** characters html_escape() replaces.
+*/
+static inline int html_clean_prefix(const char *z, int n) {
+    int i = 0;
+#if defined(__SSE2__)
+    // (c | 2) == '>' matches '<' '>', (c | 1) == '\'' matches '&' '\''
+    const __m128i lt_gt = _mm_set1_epi8('>');
+    const __m128i amp_apos = _mm_set1_epi8('\'');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (z + i));
+        __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, two), lt_gt),
+                             _mm_cmpeq_epi8(_mm_or_si128(v, one), amp_apos)),
+                _mm_cmpeq_epi8(v, quot));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        char c = z[i];
+        if (c == '&' || c == '<' || c == '>' || c == '"' || c == '\'') break;
+    }
+    return i;
+}
+
+/*
+** Return the size of z[0..n) after html_escape().
+*/
+static sqlite3_int64 html_escaped_length(const char *z, int n) {
+    sqlite3_int64 len = n;
+    int i = 0;
+    while (i < n) {
+        i += html_clean_prefix(z + i, n - i);
+        if (i < n) {
+            switch (z[i]) {
+                case '<': case '>': len += 3; break;
+                case '"': len += 5; break;
+                default: len += 4; break;   /* & ' */
+            }
+            i++;
+        }
+    }
+    return len;
+}
+
+/*
+** Write z[0..n) to out with & < > " ' replaced by character references,
+** clean runs between them are copied in bulk. Return the end of the output,
+** out must have room for html_escaped_length(z, n) bytes.
+*/
+static char *html_escape(const char *z, int n, char *out) {
+    int i = 0;
+    while (i < n) {
+        int k = html_clean_prefix(z + i, n - i);
+        memcpy(out, z + i, k);
+        out += k;
+        i += k;
+        if (i < n) {
+            switch (z[i]) {
+                case '&': memcpy(out, "&amp;", 5); out += 5; break;
+                case '<': memcpy(out, "&lt;", 4); out += 4; break;
+                case '>': memcpy(out, "&gt;", 4); out += 4; break;
+                case '"': memcpy(out, "&quot;", 6); out += 6; break;
+                default: memcpy(out, "&#39;", 5); out += 5; break;
+            }
+            i++;
+        }
+    }
+    return out;
+}
+
 /*
 ** Append text to the HighlightContext output string - ctx->zOut. Argument
 ** z points to a buffer containing n bytes of text to append. If n is
@@ -111,11 +196,15 @@ struct HighlightContext {
 ** If *pRc is set to any value other than SQLITE_OK when this function is
 ** called, it is a no-op. If an error (i.e. an OOM condition) is encountered,
 ** *pRc is set to an error code before returning.
+**
+** If bText is set, z is text from zIn[] and it's HTML-escaped in escape mode,
+** straight into the grown output string.
 */
 static void fts5HighlightAppend(
         int *pRc,
         HighlightContext *ctx,
-        const char *z, int n
+        const char *z, int n,
+        bool bText = false
 ) {
     if (n < 0) {
         CHECK_EQ(n, -1);
@@ -124,7 +213,18 @@ static void fts5HighlightAppend(
     if (*pRc == SQLITE_OK && z != nullptr) {
         if (n < 0) n = (int) strlen(z);
         CHECK_GE(n, 0);
-        ctx->zOut = sqlite3_mprintf("%z%.*s", ctx->zOut, n, z);
+        if (bText && ctx->escape) {
+            sqlite3_int64 nOut = ctx->zOut != nullptr ? (sqlite3_int64) strlen(ctx->zOut) : 0;
+            auto zOut = (char *) sqlite3_realloc64(ctx->zOut, nOut + html_escaped_length(z, n) + 1);
+            if (zOut == nullptr) {
+                sqlite3_free(ctx->zOut);
+            } else {
+                *html_escape(z, n, zOut + nOut) = '\0';
+            }
+            ctx->zOut = zOut;
+        } else {
+            ctx->zOut = sqlite3_mprintf("%z%.*s", ctx->zOut, n, z);
+        }
         if (ctx->zOut == nullptr) *pRc = SQLITE_NOMEM;
     }
 }
@@ -153,7 +253,7 @@ static inline int fts5HighlightCb(
     if (iPhrase == ctx->iter.iStart) {
         DLOG(INFO) << "iStart: " << iStartOff << " " << iEndOff;
 
-        fts5HighlightAppend(&rc, ctx, &ctx->zIn[ctx->iOff], iStartOff - ctx->iOff);
+        fts5HighlightAppend(&rc, ctx, &ctx->zIn[ctx->iOff], iStartOff - ctx->iOff, true);
         fts5HighlightAppend(&rc, ctx, ctx->zOpen, -1);
         ctx->iOff = iStartOff;
     }
@@ -163,7 +263,7 @@ static inline int fts5HighlightCb(
             DLOG(INFO) << "iEnd: " << iStartOff << " " << iEndOff;
         }
 
-        fts5HighlightAppend(&rc, ctx, &ctx->zIn[ctx->iOff], iEndOff - ctx->iOff);
+        fts5HighlightAppend(&rc, ctx, &ctx->zIn[ctx->iOff], iEndOff - ctx->iOff, true);
         fts5HighlightAppend(&rc, ctx, ctx->zClose, -1);
         ctx->iOff = iEndOff;
 
@@ -220,12 +320,15 @@ static inline void highlight3(
         const Fts5ExtensionApi *pApi,   /* API offered by current FTS version */
         Fts5Context *pFts,              /* First arg to pass to pApi functions */
         sqlite3_context *pCtx,          /* Context for returning result/error */
-        sqlite3_value **apVal           /* Array of trailing arguments */
+        sqlite3_value **apVal,          /* Array of trailing arguments */
+        bool escape                     /* HTML-escape the column text */
 ) {
     HighlightContext ctx;
     memset(&ctx, 0, sizeof(ctx));
+    ctx.escape = escape;
 
     int iCol = sqlite3_value_int(apVal[0]);
+    NGRAM_PROBE1(highlight3_entry, iCol);
     ctx.zOpen = (const char *) sqlite3_value_text(apVal[1]);
     ctx.zClose = (const char *) sqlite3_value_text(apVal[2]);
 
@@ -240,7 +343,7 @@ static inline void highlight3(
             rc = pApi->xTokenize(pFts, ctx.zIn, ctx.nIn, (void *) &ctx, fts5HighlightCb);
             if (rc == SQLITE_OK) {
                 // Append the rest of the zIn into zOut
-                fts5HighlightAppend(&rc, &ctx, &ctx.zIn[ctx.iOff], ctx.nIn - ctx.iOff);
+                fts5HighlightAppend(&rc, &ctx, &ctx.zIn[ctx.iOff], ctx.nIn - ctx.iOff, true);
             }
             if (rc == SQLITE_OK) {
                 sqlite3_result_text(pCtx, ctx.zOut, -1, SQLITE_TRANSIENT);
@@ -252,6 +355,8 @@ static inline void highlight3(
     if (rc != SQLITE_OK) {
         sqlite3_result_error_code(pCtx, rc);
     }
+
+    NGRAM_PROBE2(highlight3_return, rc, ctx.nIn);
 }
 
 void ngram_highlight(
@@ -261,12 +366,24 @@ void ngram_highlight(
         int nVal,                       /* Number of values in apVal[] array */
         sqlite3_value **apVal           /* Array of trailing arguments */
 ) {
+    NGRAM_PROBE1(highlight_entry, nVal);
+
     if (nVal == 1) {
         highlight1(pApi, pFts, pCtx, apVal);
     } else if (nVal == 3) {
-        highlight3(pApi, pFts, pCtx, apVal);
+        highlight3(pApi, pFts, pCtx, apVal, false);
+    } else if (nVal == 4) {
+        auto mode = (const char *) sqlite3_value_text(apVal[3]);
+        if (mode != nullptr && !strcmp(mode, "html")) {
+            highlight3(pApi, pFts, pCtx, apVal, true);
+        } else {
+            const char *zErr = "unknown escape mode to function " LIBNAME "_highlight(), expected 'html'";
+            sqlite3_result_error(pCtx, zErr, -1);
+        }
     } else {
         const char *zErr = "wrong number of arguments to function " LIBNAME "_highlight()";
         sqlite3_result_error(pCtx, zErr, -1);
     }
+
+    NGRAM_PROBE1(highlight_return, nVal);
 }
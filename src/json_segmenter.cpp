@@ -0,0 +1,412 @@
+#include "json_segmenter.h"
+
+#include <cstring>
+#include <glog/logging.h>
+
+#include "ngram_core.h"
+#include "dict_segmenter.h"
+#include "probes.h"
+
+namespace ngram_tokenizer {
+    JsonSegmenter::JsonSegmenter(const char *pText, int nText, const ngram_context_t *ctx, int max_tokens, bool query) {
+        CHECK_NOTNULL(pText);
+        CHECK_GE(nText, 0);
+        CHECK_NOTNULL(ctx);
+        CHECK_NE(ctx->json, NGRAM_JSON_OFF);
+        CHECK_GE(max_tokens, 0);
+        this->pText = pText;
+        this->nText = nText;
+        this->ctx = ctx;
+        this->max_tokens = max_tokens;
+        this->query = query;
+        this->iOff = 0;
+        this->gram_count = 0;
+        this->truncated = false;
+    }
+
+    static inline bool is_json_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static inline bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Parse 4 hex digits after "\u", the escape is already validated
+    static inline unsigned int hex4(const char *p) {
+        unsigned int cp = 0;
+        for (int i = 0; i < 4; i++) {
+            cp = (cp << 4) | (unsigned int) hex_value(p[i]);
+        }
+        return cp;
+    }
+
+    static void utf8_append(unsigned int cp, std::string &out) {
+        if (cp < 0x80) {
+            out += (char) cp;
+        } else if (cp < 0x800) {
+            out += (char) (0xC0 | (cp >> 6));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += (char) (0xE0 | (cp >> 12));
+            out += (char) (0x80 | ((cp >> 6) & 0x3F));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else {
+            out += (char) (0xF0 | (cp >> 18));
+            out += (char) (0x80 | ((cp >> 12) & 0x3F));
+            out += (char) (0x80 | ((cp >> 6) & 0x3F));
+            out += (char) (0x80 | (cp & 0x3F));
+        }
+    }
+
+    /**
+     * Unescape the validated JSON string body pText[iStart, iEnd)
+     *
+     * @offsets     if not nullptr, where to store the offset within pText[] of each output byte,
+     *              followed by iEnd, thus a token [i, j) of the output is at [offsets[i], offsets[j]) of pText[].
+     */
+    static void json_unescape(const char *pText, int iStart, int iEnd, std::string &out, std::vector<int> *offsets) {
+        out.clear();
+        if (offsets != nullptr) offsets->clear();
+
+        int i = iStart;
+        while (i < iEnd) {
+            size_t n = out.length();
+            int esc = i;
+            if (pText[i] != '\\') {
+                out += pText[i++];
+            } else {
+                char c = pText[i + 1];
+                i += 2;
+                switch (c) {
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u': {
+                        unsigned int cp = hex4(pText + i);
+                        i += 4;
+                        if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 <= iEnd && pText[i] == '\\' && pText[i + 1] == 'u') {
+                            unsigned int lo = hex4(pText + i + 2);
+                            if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                                i += 6;
+                            }
+                        }
+                        if (cp >= 0xD800 && cp <= 0xDFFF) {
+                            cp = 0xFFFD;    // Lone surrogate
+                        } else if (cp == 0) {
+                            cp = ' ';       // Tokens are NUL-free
+                        }
+                        utf8_append(cp, out);
+                        break;
+                    }
+                    default: out += c; break;   // '"' '\\' '/'
+                }
+            }
+            if (offsets != nullptr) {
+                // Bytes of one escape all map to its start
+                offsets->insert(offsets->end(), out.length() - n, esc);
+            }
+        }
+
+        if (offsets != nullptr) offsets->push_back(iEnd);
+    }
+
+    /**
+     * Scan the JSON string at pText[*pi] == '"', *pi is moved past the closing quote
+     *
+     * @return  false if the string is unterminated or has an invalid escape
+     */
+    bool JsonSegmenter::parse_string(int *pi, std::string *out, std::vector<int> *offsets) {
+        int i = *pi + 1;
+        bool escaped = false;
+        while (i < nText && pText[i] != '"') {
+            if (pText[i] != '\\') {
+                i++;
+                continue;
+            }
+            if (i + 1 >= nText || pText[i + 1] == '\0' || strchr("\"\\/bfnrtu", pText[i + 1]) == nullptr) {
+                return false;
+            }
+            if (pText[i + 1] == 'u') {
+                if (i + 6 > nText) return false;
+                for (int k = 2; k < 6; k++) {
+                    if (hex_value(pText[i + k]) < 0) return false;
+                }
+                i += 6;
+            } else {
+                i += 2;
+            }
+            escaped = true;
+        }
+        if (i >= nText) {
+            return false;
+        }
+
+        int iStart = *pi + 1;
+        *pi = i + 1;
+        if (out == nullptr) {
+            return true;
+        }
+        if (escaped) {
+            json_unescape(pText, iStart, i, *out, offsets);
+        } else {
+            out->assign(pText + iStart, i - iStart);
+            if (offsets != nullptr) offsets->clear();
+        }
+        return true;
+    }
+
+    // Scan the JSON number at pText[*pi], *pi is moved past it
+    bool JsonSegmenter::parse_number(int *pi) const {
+        int i = *pi;
+        if (i < nText && pText[i] == '-') i++;
+        if (i >= nText || !is_digit(pText[i])) return false;
+        if (pText[i] == '0') {
+            i++;
+        } else {
+            while (i < nText && is_digit(pText[i])) i++;
+        }
+        if (i < nText && pText[i] == '.') {
+            if (++i >= nText || !is_digit(pText[i])) return false;
+            while (i < nText && is_digit(pText[i])) i++;
+        }
+        if (i < nText && (pText[i] == 'e' || pText[i] == 'E')) {
+            i++;
+            if (i < nText && (pText[i] == '+' || pText[i] == '-')) i++;
+            if (i >= nText || !is_digit(pText[i])) return false;
+            while (i < nText && is_digit(pText[i])) i++;
+        }
+        *pi = i;
+        return true;
+    }
+
+    typedef struct {
+        void *pCtx;
+        xTokenCallback xToken;
+        int iOff;                           // Span offset within the whole input text
+        const std::vector<int> *offsets;    // Per-byte offsets of an unescaped span, nullptr if not escaped
+        const std::string *prefix;          // Key path, nullptr if no path prefixed token
+        bool prefix_only;
+        std::string buf;
+    } json_span_t;
+
+    static int json_span_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+        auto span = (json_span_t *) pCtx;
+        if (span->offsets != nullptr) {
+            iStart = (*span->offsets)[iStart];
+            iEnd = (*span->offsets)[iEnd];
+        } else {
+            iStart += span->iOff;
+            iEnd += span->iOff;
+        }
+
+        int rc = NGRAM_CORE_OK;
+        if (!span->prefix_only) {
+            rc = span->xToken(span->pCtx, tflags, pToken, nToken, iStart, iEnd);
+        }
+        if (rc == NGRAM_CORE_OK && span->prefix != nullptr) {
+            span->buf.assign(*span->prefix);
+            span->buf += '=';
+            span->buf.append(pToken, nToken);
+            if (!span->prefix_only) {
+                tflags |= NGRAM_CORE_TOKEN_COLOCATED;
+                // A prefix_only path token replaces the gram whose probe had fired, only count the colocated one
+                NGRAM_PROBE6(gram, (int) span->buf.length(), 0, iStart, iEnd, NGRAM_PROBE_PATH, tflags);
+            }
+            rc = span->xToken(span->pCtx, tflags, span->buf.c_str(), (int) span->buf.length(), iStart, iEnd);
+        }
+        return rc;
+    }
+
+    template<typename T>
+    static int run_span(T &seg, json_span_t *span, int *gram_count, bool *truncated) {
+        int rc = seg.run(span, json_span_cb);
+        *gram_count += seg.get_gram_count();
+        if (rc == NGRAM_CORE_OK && seg.is_truncated()) {
+            *truncated = true;
+            rc = NGRAM_CORE_DONE;
+        }
+        return rc;
+    }
+
+    /**
+     * Tokenize the span p[0, n)
+     *
+     * @iSpan       offset of p[] within pText[], ignored if offsets is not nullptr
+     * @offsets     per-byte offsets of an unescaped span, see json_unescape()
+     * @prefix_only emit key path prefixed tokens only
+     */
+    int JsonSegmenter::tokenize(const char *p, int n, int iSpan, const std::vector<int> *offsets, bool prefix_only,
+                                void *pCtx, xTokenCallback xToken) {
+        if (n <= 0) {
+            return NGRAM_CORE_OK;
+        }
+
+        int budget = 0;
+        if (max_tokens != 0) {
+            budget = max_tokens - gram_count;
+            if (budget <= 0) {
+                truncated = true;
+                return NGRAM_CORE_DONE;
+            }
+        }
+
+        bool prefixed = ctx->json == NGRAM_JSON_KEYS_VALUES && !path.empty();
+        json_span_t span = {pCtx, xToken, iSpan, offsets, prefixed ? &path : nullptr, prefixed && prefix_only, ""};
+        if (ctx->dict != nullptr) {
+            DictSegmenter ds(p, n, ctx, budget);
+            return run_span(ds, &span, &gram_count, &truncated);
+        }
+        GramStream gs(p, n, ctx, budget);
+        return run_span(gs, &span, &gram_count, &truncated);
+    }
+
+    typedef struct {
+        char type;          // '{' or '['
+        size_t path_len;    // Key path length of the container
+    } json_frame_t;
+
+    static const int JSON_MALFORMED = -1;
+
+    typedef enum {
+        JSON_WANT_VALUE,
+        JSON_WANT_KEY,
+        JSON_WANT_NEXT,     // ',' or a closing bracket
+    } json_state_t;
+
+    static inline bool json_literal(const char *p, int n, const char *lit, int nLit) {
+        return n >= nLit && !memcmp(p, lit, nLit);
+    }
+
+    /**
+     * Stream through the JSON text, tokenize string/number values
+     *  multiple top-level values(e.g. JSON lines) are allowed.
+     *
+     * @return  JSON_MALFORMED if the JSON is malformed, iOff is left at the error
+     *          otherwise same as GramStream::run()
+     */
+    int JsonSegmenter::parse(void *pCtx, xTokenCallback xToken) {
+        const bool keys = ctx->json == NGRAM_JSON_KEYS_VALUES;
+        std::vector<json_frame_t> stack;
+        json_state_t state = JSON_WANT_VALUE;
+        int &i = iOff;
+        int rc = NGRAM_CORE_OK;
+
+        while (rc == NGRAM_CORE_OK) {
+            while (i < nText && is_json_space(pText[i])) i++;
+            if (i >= nText) {
+                return stack.empty() ? NGRAM_CORE_OK : JSON_MALFORMED;
+            }
+
+            char c = pText[i];
+            if (state == JSON_WANT_NEXT) {
+                if (stack.empty()) {
+                    state = JSON_WANT_VALUE;    // Next top-level value
+                } else if (c == ',') {
+                    i++;
+                    state = stack.back().type == '{' ? JSON_WANT_KEY : JSON_WANT_VALUE;
+                } else if (c == (stack.back().type == '{' ? '}' : ']')) {
+                    i++;
+                    path.resize(stack.back().path_len);
+                    stack.pop_back();
+                } else {
+                    return JSON_MALFORMED;
+                }
+            } else if (state == JSON_WANT_KEY) {
+                if (c != '"' || !parse_string(&i, keys ? &value : nullptr, nullptr)) {
+                    return JSON_MALFORMED;
+                }
+                if (keys) {
+                    path.resize(stack.back().path_len);
+                    if (!path.empty()) path += '.';
+                    path += value;
+                }
+                while (i < nText && is_json_space(pText[i])) i++;
+                if (i >= nText || pText[i] != ':') {
+                    return JSON_MALFORMED;
+                }
+                i++;
+                state = JSON_WANT_VALUE;
+            } else if (c == '{' || c == '[') {
+                stack.push_back({c, path.length()});
+                i++;
+                while (i < nText && is_json_space(pText[i])) i++;
+                if (i < nText && pText[i] == (c == '{' ? '}' : ']')) {
+                    i++;
+                    stack.pop_back();
+                    state = JSON_WANT_NEXT;
+                } else {
+                    state = c == '{' ? JSON_WANT_KEY : JSON_WANT_VALUE;
+                }
+            } else {
+                int iStart = i;
+                if (c == '"') {
+                    if (!parse_string(&i, &value, &offsets)) return JSON_MALFORMED;
+                    rc = tokenize(value.data(), (int) value.length(), iStart + 1,
+                                  offsets.empty() ? nullptr : &offsets, false, pCtx, xToken);
+                } else if (c == '-' || is_digit(c)) {
+                    if (!parse_number(&i)) return JSON_MALFORMED;
+                    rc = tokenize(pText + iStart, i - iStart, iStart, nullptr, false, pCtx, xToken);
+                } else if (json_literal(pText + i, nText - i, "true", 4) || json_literal(pText + i, nText - i, "null", 4)) {
+                    i += 4;
+                } else if (json_literal(pText + i, nText - i, "false", 5)) {
+                    i += 5;
+                } else {
+                    return JSON_MALFORMED;
+                }
+                state = JSON_WANT_NEXT;
+            }
+        }
+
+        return rc;
+    }
+
+    /**
+     * @return  same as GramStream::run()
+     */
+    int JsonSegmenter::run(void *pCtx, xTokenCallback xToken) {
+        CHECK_NOTNULL(xToken);
+
+        int rc;
+        if (query) {
+            const char *eq = ctx->json == NGRAM_JSON_KEYS_VALUES ? (const char *) memchr(pText, '=', nText) : nullptr;
+            if (eq != nullptr && eq != pText) {
+                path.assign(pText, eq - pText);
+                int k = (int) (eq - pText) + 1;
+                rc = tokenize(eq + 1, nText - k, k, nullptr, true, pCtx, xToken);
+            } else {
+                rc = tokenize(pText, nText, 0, nullptr, false, pCtx, xToken);
+            }
+        } else {
+            rc = parse(pCtx, xToken);
+            if (rc == JSON_MALFORMED) {
+                DLOG(INFO) << "Malformed JSON at offset " << iOff << ", tokenize the rest as plain text";
+                path.clear();
+                rc = tokenize(pText + iOff, nText - iOff, iOff, nullptr, false, pCtx, xToken);
+            }
+        }
+
+        if (rc == NGRAM_CORE_DONE && truncated) {
+            rc = NGRAM_CORE_OK;
+        }
+        return rc;
+    }
+
+    bool JsonSegmenter::is_truncated() const {
+        return truncated;
+    }
+
+    int JsonSegmenter::get_gram_count() const {
+        return gram_count;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ngram_context.h"
+#include "gram_stream.h"
+
+namespace ngram_tokenizer {
+    /**
+     * JSON segmenter
+     *  Stream through a JSON text without building a DOM, only string/number values are tokenized
+     *  (by GramStream, or DictSegmenter if a dictionary is specified), token offsets point into the original text.
+     *  In keys+values mode each value token is followed by a colocated "<key path>=<token>" token,
+     *  where the key path is object keys joined by '.'(array indexes are omitted).
+     *
+     *  Queries aren't JSON, they're tokenized as plain text, in keys+values mode a "<key path>=<text>" query
+     *  is tokenized into key path prefixed tokens only. Malformed JSON is tokenized as plain text from the error on.
+     */
+    class JsonSegmenter {
+    public:
+        JsonSegmenter(const char *, int, const ngram_context_t *, int, bool);
+
+        int run(void *, xTokenCallback);
+
+        bool is_truncated() const;
+
+        int get_gram_count() const;
+
+    private:
+        int parse(void *, xTokenCallback);
+
+        bool parse_string(int *, std::string *, std::vector<int> *);
+
+        bool parse_number(int *) const;
+
+        int tokenize(const char *, int, int, const std::vector<int> *, bool, void *, xTokenCallback);
+
+        const char *pText;
+        int nText;
+        const ngram_context_t *ctx;
+        int max_tokens;     // 0 means unlimited
+        bool query;
+
+        int iOff;           // Current offset within pText[]
+        std::string path;   // Key path of the current value
+        std::string value;  // Reusable unescaped string buffer
+        std::vector<int> offsets;   // Offset of each unescaped byte within pText[]
+        int gram_count;
+        bool truncated;
+    };
+}
@@ -0,0 +1,352 @@
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "like.h"
+#include "options.h"
+#include "token_vector.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// LIKE/GLOB acceleration over an existing ngram FTS5 table
+//
+//  SELECT * FROM docs WHERE rowid IN (SELECT id FROM ngram_like('docs_fts', 'body', '%ubuntu linux%'));
+//  SELECT * FROM docs WHERE rowid IN (SELECT id FROM ngram_glob('docs_fts', 'body', '*Ubuntu*'));
+//
+// Literal segments of the pattern are turned into an FTS5 MATCH expression which selects a superset of the
+//  matching rows, the candidates are then verified by the built-in LIKE/GLOB, thus the result is exact.
+//
+// see:
+//  https://www.sqlite.org/vtab.html#tabfunc2
+//  https://github.com/sqlite/sqlite/blob/master/ext/misc/series.c
+
+namespace ngram_tokenizer {
+    std::string quote_match_string(const std::string &s) {
+        std::string quoted = "\"";
+        for (char c: s) {
+            if (c == '"') quoted += '"';
+            quoted += c;
+        }
+        quoted += '"';
+        return quoted;
+    }
+
+    /**
+     * Append MATCH terms which every text containing seg[0, n) must contain
+     *
+     * A term is only emitted when the document is guaranteed to index it:
+     *  alphanumeric and punctuation runs cut by a wildcard may be a part of a longer document token,
+     *  thus the leading one is dropped and the trailing one becomes a prefix query.
+     *  Runs of OTHER characters shorter than N are only indexed at run boundaries, thus dropped as well.
+     */
+    void literal_match_terms(
+            const char *seg, int n,
+            bool anchor_left, bool anchor_right,
+            const ngram_context_t *opts,
+            std::vector<std::string> &terms) {
+        TokenVector tv(seg, n, opts->grapheme);
+        if (!tv.tokenize()) {
+            return;
+        }
+        const auto &tokens = tv.get_tokens();
+
+        size_t lo = 0;
+        size_t hi = tokens.size();
+        bool prefix = false;
+        if (lo < hi && !anchor_left && tokens[lo].get_iStart() == 0 && tokens[lo].get_category() != OTHER) {
+            lo++;
+        }
+        if (lo < hi && !anchor_right && tokens[hi - 1].get_iEnd() == n && tokens[hi - 1].get_category() != OTHER) {
+            prefix = true;
+        }
+
+        for (size_t i = lo; i < hi;) {
+            if (tokens[i].get_category() != OTHER) {
+                terms.emplace_back(quote_match_string(tokens[i].get_str()));
+                if (prefix && i + 1 == hi) {
+                    terms.back() += "*";
+                }
+                i++;
+                continue;
+            }
+
+            std::string run;
+            size_t j = i;
+            for (; j < hi && tokens[j].get_category() == OTHER; j++) {
+                run += tokens[j].get_str();
+            }
+            if (j - i >= (size_t) opts->ngram) {
+                terms.emplace_back(quote_match_string(run));
+            }
+            i = j;
+        }
+    }
+
+    /**
+     * Build an FTS5 MATCH expression selecting a superset of the texts matching a LIKE/GLOB pattern
+     *
+     * @return  "" if no literal segment is usable, i.e. every row is a candidate
+     */
+    std::string like_match_expr(const char *zPattern, bool glob, const ngram_context_t *opts) {
+        CHECK_NOTNULL(zPattern);
+        CHECK_NOTNULL(opts);
+
+        std::vector<std::string> terms;
+        const int n = (int) strlen(zPattern);
+        int segStart = 0;
+
+        for (int i = 0; i <= n; i++) {
+            int wildcardEnd = i;    // Exclusive
+            if (i == n) {
+                wildcardEnd = n;
+            } else if (!glob && (zPattern[i] == '%' || zPattern[i] == '_')) {
+                wildcardEnd = i + 1;
+            } else if (glob && (zPattern[i] == '*' || zPattern[i] == '?')) {
+                wildcardEnd = i + 1;
+            } else if (glob && zPattern[i] == '[') {
+                // Character class, "]" right after "[" or "[^" is a literal member
+                int j = i + 1;
+                if (j < n && zPattern[j] == '^') j++;
+                if (j < n && zPattern[j] == ']') j++;
+                while (j < n && zPattern[j] != ']') j++;
+                wildcardEnd = j < n ? j + 1 : n;
+            } else {
+                continue;
+            }
+
+            if (i > segStart) {
+                literal_match_terms(zPattern + segStart, i - segStart, segStart == 0, i == n, opts, terms);
+            }
+            if (i == n) {
+                break;
+            }
+            segStart = wildcardEnd;
+            i = wildcardEnd - 1;
+        }
+
+        std::string expr;
+        for (const auto &term: terms) {
+            if (!expr.empty()) expr += " AND ";
+            expr += term;
+        }
+        return expr;
+    }
+}
+
+#define LIKE_COLUMN_ID      0
+#define LIKE_COLUMN_TABLE   1
+#define LIKE_COLUMN_COLUMN  2
+#define LIKE_COLUMN_PATTERN 3
+#define LIKE_ARGC           3
+
+typedef struct {
+    sqlite3_vtab base;
+    sqlite3 *db;
+    bool glob;
+} LikeVtab;
+
+typedef struct {
+    sqlite3_vtab_cursor base;
+    sqlite3_stmt *pStmt;
+    bool eof;
+} LikeCursor;
+
+static int likeConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                       sqlite3_vtab **ppVtab, char **pzErr) {
+    UNUSED(argc, argv);
+    UNUSED(pzErr);
+
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(id INTEGER, tbl HIDDEN, col HIDDEN, pattern HIDDEN)");
+    if (rc != SQLITE_OK) return rc;
+
+    auto p = (LikeVtab *) sqlite3_malloc(sizeof(LikeVtab));
+    if (p == nullptr) return SQLITE_NOMEM;
+    (void) memset(p, 0, sizeof(*p));
+    p->db = db;
+    p->glob = pAux != nullptr;
+    (void) sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+    *ppVtab = &p->base;
+    return SQLITE_OK;
+}
+
+static int likeDisconnect(sqlite3_vtab *pVtab) {
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+static int likeOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+    UNUSED(pVtab);
+    auto p = (LikeCursor *) sqlite3_malloc(sizeof(LikeCursor));
+    if (p == nullptr) return SQLITE_NOMEM;
+    (void) memset(p, 0, sizeof(*p));
+    p->eof = true;
+    *ppCursor = &p->base;
+    return SQLITE_OK;
+}
+
+static int likeClose(sqlite3_vtab_cursor *pCursor) {
+    auto p = (LikeCursor *) pCursor;
+    (void) sqlite3_finalize(p->pStmt);
+    sqlite3_free(p);
+    return SQLITE_OK;
+}
+
+static int likeNext(sqlite3_vtab_cursor *pCursor) {
+    auto p = (LikeCursor *) pCursor;
+    int rc = sqlite3_step(p->pStmt);
+    p->eof = rc != SQLITE_ROW;
+    if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+        return SQLITE_OK;
+    }
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(((LikeVtab *) pCursor->pVtab)->db));
+    return rc;
+}
+
+static int likeFilter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    UNUSED(idxNum, idxStr);
+    auto p = (LikeCursor *) pCursor;
+    auto pVtab = (LikeVtab *) pCursor->pVtab;
+
+    (void) sqlite3_finalize(p->pStmt);
+    p->pStmt = nullptr;
+    p->eof = true;
+
+    CHECK_EQ(argc, LIKE_ARGC);
+    auto zTable = (const char *) sqlite3_value_text(argv[0]);
+    auto zColumn = (const char *) sqlite3_value_text(argv[1]);
+    auto zPattern = (const char *) sqlite3_value_text(argv[2]);
+    if (zTable == nullptr || zColumn == nullptr || zPattern == nullptr) {
+        return SQLITE_OK;
+    }
+
+    ngram_context_t opts;
+    bool has_dict = false;
+    bool wrapped = false;
+    if (!ngram_tokenizer::table_options(pVtab->db, zTable, &opts, &has_dict, &wrapped)) {
+        pVtab->base.zErrMsg = sqlite3_mprintf("%s is not an FTS5 table using the " LIBNAME " tokenizer", zTable);
+        return SQLITE_ERROR;
+    }
+
+    // Candidates must be a superset of the matching rows, otherwise fall back to scan the table:
+    //  dictionary words are not decomposed into grams, truncated documents lack trailing grams,
+    //  LIKE is case-insensitive while a case_sensitive table isn't, grams of json tables don't span JSON structure,
+    //  a wrapping tokenizer(e.g. porter) rewrites document tokens but not the prefix terms.
+    std::string expr;
+    if (!has_dict && !wrapped && opts.max_tokens == 0 && opts.json == NGRAM_JSON_OFF &&
+        (pVtab->glob || !opts.case_sensitive)) {
+        expr = ngram_tokenizer::like_match_expr(zPattern, pVtab->glob, &opts);
+    }
+    DLOG(INFO) << "pattern: " << zPattern << " MATCH: " << expr;
+
+    const char *op = pVtab->glob ? "GLOB" : "LIKE";
+    char *zSql;
+    if (expr.empty()) {
+        zSql = sqlite3_mprintf("SELECT rowid FROM \"%w\" WHERE \"%w\" %s ?2", zTable, zColumn, op);
+    } else {
+        zSql = sqlite3_mprintf("SELECT rowid FROM \"%w\" WHERE \"%w\" MATCH ?1 AND \"%w\" %s ?2",
+                               zTable, zTable, zColumn, op);
+    }
+    if (zSql == nullptr) return SQLITE_NOMEM;
+
+    std::string match = "{" + ngram_tokenizer::quote_match_string(zColumn) + "} : (" + expr + ")";
+    int rc = sqlite3_prepare_v2(pVtab->db, zSql, -1, &p->pStmt, nullptr);
+    sqlite3_free(zSql);
+    if (rc == SQLITE_OK && !expr.empty()) {
+        rc = sqlite3_bind_text(p->pStmt, 1, match.c_str(), -1, SQLITE_TRANSIENT);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_bind_text(p->pStmt, 2, zPattern, -1, SQLITE_TRANSIENT);
+    }
+    if (rc != SQLITE_OK) {
+        pVtab->base.zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(pVtab->db));
+        return rc;
+    }
+
+    return likeNext(pCursor);
+}
+
+static int likeEof(sqlite3_vtab_cursor *pCursor) {
+    return ((LikeCursor *) pCursor)->eof;
+}
+
+static int likeColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx, int i) {
+    auto p = (LikeCursor *) pCursor;
+    if (i == LIKE_COLUMN_ID) {
+        sqlite3_result_int64(pCtx, sqlite3_column_int64(p->pStmt, 0));
+    }
+    return SQLITE_OK;
+}
+
+static int likeRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid) {
+    *pRowid = sqlite3_column_int64(((LikeCursor *) pCursor)->pStmt, 0);
+    return SQLITE_OK;
+}
+
+/*
+** All of tbl, col and pattern are required, they're passed to xFilter() in this order
+*/
+static int likeBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo) {
+    UNUSED(pVtab);
+
+    int aIdx[LIKE_ARGC] = {-1, -1, -1};
+    for (int i = 0; i < pInfo->nConstraint; i++) {
+        const auto &c = pInfo->aConstraint[i];
+        if (c.iColumn < LIKE_COLUMN_TABLE || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+        if (!c.usable) return SQLITE_CONSTRAINT;
+        aIdx[c.iColumn - LIKE_COLUMN_TABLE] = i;
+    }
+
+    for (int k = 0; k < LIKE_ARGC; k++) {
+        if (aIdx[k] < 0) {
+            pVtab->zErrMsg = sqlite3_mprintf("tbl, col and pattern arguments are required");
+            return SQLITE_ERROR;
+        }
+        pInfo->aConstraintUsage[aIdx[k]].argvIndex = k + 1;
+        pInfo->aConstraintUsage[aIdx[k]].omit = 1;
+    }
+    pInfo->estimatedCost = 1000.0;
+    pInfo->estimatedRows = 100;
+    return SQLITE_OK;
+}
+
+static sqlite3_module like_module = {
+        /* iVersion    */ 0,
+        /* xCreate     */ nullptr,
+        /* xConnect    */ likeConnect,
+        /* xBestIndex  */ likeBestIndex,
+        /* xDisconnect */ likeDisconnect,
+        /* xDestroy    */ nullptr,
+        /* xOpen       */ likeOpen,
+        /* xClose      */ likeClose,
+        /* xFilter     */ likeFilter,
+        /* xNext       */ likeNext,
+        /* xEof        */ likeEof,
+        /* xColumn     */ likeColumn,
+        /* xRowid      */ likeRowid,
+        /* xUpdate     */ nullptr,
+        /* xBegin      */ nullptr,
+        /* xSync       */ nullptr,
+        /* xCommit     */ nullptr,
+        /* xRollback   */ nullptr,
+        /* xFindMethod */ nullptr,
+        /* xRename     */ nullptr,
+        /* xSavepoint  */ nullptr,
+        /* xRelease    */ nullptr,
+        /* xRollbackTo */ nullptr,
+        /* xShadowName */ nullptr,
+};
+
+/*
+** Register the eponymous-only table-valued functions ngram_like() and ngram_glob()
+*/
+int ngram_like_init(sqlite3 *db) {
+    int rc = sqlite3_create_module(db, LIBNAME "_like", &like_module, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_module(db, LIBNAME "_glob", &like_module, (void *) &like_module);
+    }
+    return rc;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+#include <string>
+#include <vector>
+
+#include "ngram_context.h"
+
+namespace ngram_tokenizer {
+    std::string like_match_expr(const char *, bool, const ngram_context_t *);
+
+    std::string quote_match_string(const std::string &);
+
+    void literal_match_terms(const char *, int, bool, bool, const ngram_context_t *, std::vector<std::string> &);
+}
+
+int ngram_like_init(sqlite3 *);
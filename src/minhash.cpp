@@ -0,0 +1,383 @@
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "minhash.h"
+#include "similarity.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// MinHash signatures and LSH banding for near-duplicate detection
+//
+//  CREATE TABLE doc_lsh(band INTEGER, key INTEGER, id INTEGER);
+//  CREATE INDEX doc_lsh_key ON doc_lsh(band, key);
+//
+//  INSERT INTO doc_lsh SELECT band, key, :id FROM ngram_lsh(ngram_minhash(:text, 2, 128), 16);
+//
+//  SELECT DISTINCT l.id FROM ngram_lsh(ngram_minhash(:text, 2, 128), 16) q JOIN doc_lsh l USING (band, key);
+//
+// The signature blob is k little-endian uint32 values, the i-th being the minimum of h_i() over the
+//  gram hashes of the text(see similarity.cpp), where h_i(x) = f((x ^ s_i) * m_i) and f(y) = y ^ (y >> 15).
+//  Seeds are fixed so signatures stay comparable across processes, don't change them.
+//
+// see:
+//  Leskovec et al., Mining of Massive Datasets, 3.4 Locality-Sensitive Hashing for Documents
+//  http://infolab.stanford.edu/~ullman/mmds/ch3n.pdf
+
+#define MAX_MINHASH     1024    /* Max signature size */
+
+/*
+** Per-function hash seeds, structure of arrays so lanes map to SIMD registers
+*/
+typedef struct {
+    uint32_t aXor[MAX_MINHASH];
+    uint32_t aMul[MAX_MINHASH];     /* Odd multipliers */
+} MinHashSeeds;
+
+static const MinHashSeeds *minhash_seeds() {
+    static const MinHashSeeds *seeds = []() {
+        static MinHashSeeds s;
+        // splitmix64, see: https://prng.di.unimi.it/splitmix64.c
+        uint64_t x = 0x6e6772616d6d6868ULL;
+        for (int i = 0; i < MAX_MINHASH; i++) {
+            for (int j = 0; j < 2; j++) {
+                uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                z ^= z >> 31;
+                if (j == 0) {
+                    s.aXor[i] = (uint32_t) z;
+                } else {
+                    s.aMul[i] = (uint32_t) z | 1u;
+                }
+            }
+        }
+        return &s;
+    }();
+    return seeds;
+}
+
+#if defined(__SSE2__)
+// SSE2 lacks _mm_mullo_epi32(), multiply even and odd lanes separately
+static inline __m128i mullo_epi32(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+namespace ngram_tokenizer {
+    /**
+     * Fold gram hashes into the first k minimums of a signature
+     *  sig must be initialized to UINT32_MAX for a new signature.
+     */
+    void minhash_update(const uint32_t *aHash, size_t nHash, int k, uint32_t *sig) {
+        CHECK_LE(k, MAX_MINHASH);
+        const MinHashSeeds *s = minhash_seeds();
+        int i = 0;
+
+#if defined(__SSE2__)
+        // 4 hash functions per register, the signature block stays in a register across all grams
+        const __m128i bias = _mm_set1_epi32((int) 0x80000000u);
+        for (; i + 4 <= k; i += 4) {
+            __m128i vXor = _mm_loadu_si128((const __m128i *) (s->aXor + i));
+            __m128i vMul = _mm_loadu_si128((const __m128i *) (s->aMul + i));
+            // Biased so that signed comparison orders unsigned values
+            __m128i vMin = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (sig + i)), bias);
+            for (size_t j = 0; j < nHash; j++) {
+                __m128i y = mullo_epi32(_mm_xor_si128(_mm_set1_epi32((int) aHash[j]), vXor), vMul);
+                y = _mm_xor_si128(_mm_xor_si128(y, _mm_srli_epi32(y, 15)), bias);
+                __m128i lt = _mm_cmplt_epi32(y, vMin);
+                vMin = _mm_or_si128(_mm_and_si128(lt, y), _mm_andnot_si128(lt, vMin));
+            }
+            _mm_storeu_si128((__m128i *) (sig + i), _mm_xor_si128(vMin, bias));
+        }
+#endif
+
+        for (; i < k; i++) {
+            uint32_t m = sig[i];
+            for (size_t j = 0; j < nHash; j++) {
+                uint32_t y = (aHash[j] ^ s->aXor[i]) * s->aMul[i];
+                y ^= y >> 15;
+                if (y < m) m = y;
+            }
+            sig[i] = m;
+        }
+    }
+}
+
+static inline uint32_t sig_get(const unsigned char *p, int i) {
+    p += i * 4;
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * SQL function ngram_minhash(text, N, k)
+ *  Return the k-value MinHash signature blob of the case insensitive N-gram set of text,
+ *  NULL if text has no gram, otherwise all such texts would share a signature and collide in every LSH band.
+ */
+static void ngram_minhash(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_EQ(nVal, 3);
+
+    auto zText = (const char *) sqlite3_value_text(apVal[0]);
+    int nText = sqlite3_value_bytes(apVal[0]);
+    if (zText == nullptr) {
+        return;
+    }
+
+    ngram_context_t opts;
+    (void) memset(&opts, 0, sizeof(opts));
+    opts.ngram = sqlite3_value_int(apVal[1]);
+    if (opts.ngram < MIN_GRAM || opts.ngram > MAX_GRAM) {
+        sqlite3_result_error(pCtx, "N is out of range of function " LIBNAME "_minhash()", -1);
+        return;
+    }
+
+    int k = sqlite3_value_int(apVal[2]);
+    if (k < 1 || k > MAX_MINHASH) {
+        sqlite3_result_error(pCtx, "k is out of range of function " LIBNAME "_minhash()", -1);
+        return;
+    }
+
+    std::vector<uint32_t> aHash;
+    int rc = ngram_tokenizer::gram_hashes(zText, nText, &opts, aHash);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(pCtx, rc);
+        return;
+    }
+    if (aHash.empty()) {
+        return;
+    }
+
+    std::vector<uint32_t> sig(k, UINT32_MAX);
+    ngram_tokenizer::minhash_update(aHash.data(), aHash.size(), k, sig.data());
+
+    auto p = (unsigned char *) sqlite3_malloc(k * 4);
+    if (p == nullptr) {
+        sqlite3_result_error_nomem(pCtx);
+        return;
+    }
+    for (int i = 0; i < k; i++) {
+        p[i * 4] = (unsigned char) sig[i];
+        p[i * 4 + 1] = (unsigned char) (sig[i] >> 8);
+        p[i * 4 + 2] = (unsigned char) (sig[i] >> 16);
+        p[i * 4 + 3] = (unsigned char) (sig[i] >> 24);
+    }
+    sqlite3_result_blob(pCtx, p, k * 4, sqlite3_free);
+}
+
+/**
+ * SQL function ngram_minhash_similarity(sig1, sig2)
+ *  Return the estimated Jaccard similarity of two signatures of the same size.
+ */
+static void ngram_minhash_similarity(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_EQ(nVal, 2);
+
+    auto p1 = (const unsigned char *) sqlite3_value_blob(apVal[0]);
+    int n1 = sqlite3_value_bytes(apVal[0]);
+    auto p2 = (const unsigned char *) sqlite3_value_blob(apVal[1]);
+    int n2 = sqlite3_value_bytes(apVal[1]);
+    if (p1 == nullptr || p2 == nullptr) {
+        return;
+    }
+    if (n1 != n2 || n1 % 4 != 0) {
+        sqlite3_result_error(pCtx, "signatures of different sizes", -1);
+        return;
+    }
+
+    int k = n1 / 4;
+    int same = 0;
+    for (int i = 0; i < k; i++) {
+        same += sig_get(p1, i) == sig_get(p2, i);
+    }
+    sqlite3_result_double(pCtx, (double) same / k);
+}
+
+#define LSH_COLUMN_BAND     0
+#define LSH_COLUMN_KEY      1
+#define LSH_COLUMN_SIG      2
+#define LSH_COLUMN_BANDS    3
+#define LSH_ARGC            2
+
+typedef struct {
+    sqlite3_vtab base;
+} LshVtab;
+
+typedef struct {
+    sqlite3_vtab_cursor base;
+    std::vector<sqlite3_int64> *pKeys;  /* Bucket key of each band */
+    int iBand;
+} LshCursor;
+
+static int lshConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                      sqlite3_vtab **ppVtab, char **pzErr) {
+    UNUSED(pAux, argc);
+    UNUSED(argv, pzErr);
+
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(band INTEGER, key INTEGER, sig HIDDEN, bands HIDDEN)");
+    if (rc != SQLITE_OK) return rc;
+
+    auto p = (LshVtab *) sqlite3_malloc(sizeof(LshVtab));
+    if (p == nullptr) return SQLITE_NOMEM;
+    (void) memset(p, 0, sizeof(*p));
+    (void) sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+    *ppVtab = &p->base;
+    return SQLITE_OK;
+}
+
+static int lshDisconnect(sqlite3_vtab *pVtab) {
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+static int lshOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+    UNUSED(pVtab);
+    auto p = (LshCursor *) sqlite3_malloc(sizeof(LshCursor));
+    if (p == nullptr) return SQLITE_NOMEM;
+    (void) memset(p, 0, sizeof(*p));
+    p->pKeys = new(std::nothrow) std::vector<sqlite3_int64>();
+    if (p->pKeys == nullptr) {
+        sqlite3_free(p);
+        return SQLITE_NOMEM;
+    }
+    *ppCursor = &p->base;
+    return SQLITE_OK;
+}
+
+static int lshClose(sqlite3_vtab_cursor *pCursor) {
+    auto p = (LshCursor *) pCursor;
+    delete p->pKeys;
+    sqlite3_free(p);
+    return SQLITE_OK;
+}
+
+static int lshNext(sqlite3_vtab_cursor *pCursor) {
+    ((LshCursor *) pCursor)->iBand++;
+    return SQLITE_OK;
+}
+
+static int lshFilter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    UNUSED(idxNum, idxStr);
+    auto p = (LshCursor *) pCursor;
+    p->pKeys->clear();
+    p->iBand = 0;
+
+    CHECK_EQ(argc, LSH_ARGC);
+    auto pSig = (const unsigned char *) sqlite3_value_blob(argv[0]);
+    int nSig = sqlite3_value_bytes(argv[0]);
+    int nBand = sqlite3_value_int(argv[1]);
+    if (pSig == nullptr) {
+        return SQLITE_OK;
+    }
+
+    int k = nSig / 4;
+    if (nSig % 4 != 0 || nBand < 1 || k % nBand != 0) {
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf("bands must divide the signature size %d", k);
+        return SQLITE_ERROR;
+    }
+
+    // 64-bit FNV-1a over the rows of each band
+    int nRow = k / nBand;
+    for (int b = 0; b < nBand; b++) {
+        uint64_t h = 14695981039346656037ULL;
+        for (int i = b * nRow * 4; i < (b + 1) * nRow * 4; i++) {
+            h ^= pSig[i];
+            h *= 1099511628211ULL;
+        }
+        p->pKeys->push_back((sqlite3_int64) h);
+    }
+    return SQLITE_OK;
+}
+
+static int lshEof(sqlite3_vtab_cursor *pCursor) {
+    auto p = (LshCursor *) pCursor;
+    return p->iBand >= (int) p->pKeys->size();
+}
+
+static int lshColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx, int i) {
+    auto p = (LshCursor *) pCursor;
+    if (i == LSH_COLUMN_BAND) {
+        sqlite3_result_int(pCtx, p->iBand);
+    } else if (i == LSH_COLUMN_KEY) {
+        sqlite3_result_int64(pCtx, (*p->pKeys)[p->iBand]);
+    }
+    return SQLITE_OK;
+}
+
+static int lshRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid) {
+    *pRowid = ((LshCursor *) pCursor)->iBand;
+    return SQLITE_OK;
+}
+
+/*
+** Both of sig and bands are required, they're passed to xFilter() in this order
+*/
+static int lshBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo) {
+    int aIdx[LSH_ARGC] = {-1, -1};
+    for (int i = 0; i < pInfo->nConstraint; i++) {
+        const auto &c = pInfo->aConstraint[i];
+        if (c.iColumn < LSH_COLUMN_SIG || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+        if (!c.usable) return SQLITE_CONSTRAINT;
+        aIdx[c.iColumn - LSH_COLUMN_SIG] = i;
+    }
+
+    for (int k = 0; k < LSH_ARGC; k++) {
+        if (aIdx[k] < 0) {
+            pVtab->zErrMsg = sqlite3_mprintf("sig and bands arguments are required");
+            return SQLITE_ERROR;
+        }
+        pInfo->aConstraintUsage[aIdx[k]].argvIndex = k + 1;
+        pInfo->aConstraintUsage[aIdx[k]].omit = 1;
+    }
+    pInfo->estimatedCost = 10.0;
+    pInfo->estimatedRows = 16;
+    return SQLITE_OK;
+}
+
+static sqlite3_module lsh_module = {
+        /* iVersion    */ 0,
+        /* xCreate     */ nullptr,
+        /* xConnect    */ lshConnect,
+        /* xBestIndex  */ lshBestIndex,
+        /* xDisconnect */ lshDisconnect,
+        /* xDestroy    */ nullptr,
+        /* xOpen       */ lshOpen,
+        /* xClose      */ lshClose,
+        /* xFilter     */ lshFilter,
+        /* xNext       */ lshNext,
+        /* xEof        */ lshEof,
+        /* xColumn     */ lshColumn,
+        /* xRowid      */ lshRowid,
+        /* xUpdate     */ nullptr,
+        /* xBegin      */ nullptr,
+        /* xSync       */ nullptr,
+        /* xCommit     */ nullptr,
+        /* xRollback   */ nullptr,
+        /* xFindMethod */ nullptr,
+        /* xRename     */ nullptr,
+        /* xSavepoint  */ nullptr,
+        /* xRelease    */ nullptr,
+        /* xRollbackTo */ nullptr,
+        /* xShadowName */ nullptr,
+};
+
+int ngram_minhash_init(sqlite3 *db) {
+    int rc = sqlite3_create_function(db, LIBNAME "_minhash", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                     ngram_minhash, nullptr, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_minhash_similarity", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                     nullptr, ngram_minhash_similarity, nullptr, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_module(db, LIBNAME "_lsh", &lsh_module, nullptr);
+    }
+    return rc;
+}
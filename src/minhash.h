@@ -0,0 +1,12 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ngram_tokenizer {
+    void minhash_update(const uint32_t *, size_t, int, uint32_t *);
+}
+
+int ngram_minhash_init(sqlite3 *);
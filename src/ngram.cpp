@@ -5,18 +5,29 @@
  * see: LICENSE.
  */
 
+#include <atomic>
 #include <cstring>
 #include <glog/logging.h>
 #include <iostream>
-#include <algorithm>
+#include <mutex>
 
 #include "sqlite/sqlite3ext.h"      /* Do not use <sqlite3.h>! */
 
 SQLITE_EXTENSION_INIT1
 
 #include "utils.h"
-#include "token_vector.h"
+#include "ngram_core.h"
+#include "probes.h"
+#include "gram_stream.h"
+#include "double_array_trie.h"
 #include "highlight.h"
+#include "rank.h"
+#include "like.h"
+#include "minhash.h"
+#include "plan.h"
+#include "profile.h"
+#include "regex_query.h"
+#include "similarity.h"
 
 /**
  * [qt.]
@@ -36,7 +47,8 @@ static inline fts5_api *fts5_api_from_db(sqlite3 *db) {
     fts5_api *pFts5Api = nullptr;
     sqlite3_stmt *pStmt = nullptr;
 
-    if (sqlite3_prepare(db, "SELECT fts5(?1)", -1, &pStmt, nullptr) == SQLITE_OK) {
+    // fts5_api is per-connection, thus this can't be cached across loads
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &pStmt, nullptr) == SQLITE_OK) {
         if (sqlite3_bind_pointer(pStmt, 1, (void *) &pFts5Api, "fts5_api_ptr", nullptr) == SQLITE_OK) {
             int rc = sqlite3_step(pStmt);
             CHECK_EQ(rc, SQLITE_ROW);
@@ -52,18 +64,16 @@ static inline fts5_api *fts5_api_from_db(sqlite3 *db) {
     return pFts5Api;
 }
 
-// see:
-//  7.1. Custom Tokenizers
-//  https://sqlite.org/fts5.html#custom_tokenizers
+// ngram_core status codes and flags are passed through as-is
+static_assert(NGRAM_CORE_OK == SQLITE_OK && NGRAM_CORE_ERROR == SQLITE_ERROR && NGRAM_CORE_DONE == SQLITE_DONE,
+              "ngram_core status codes must match SQLite result codes");
+static_assert(NGRAM_CORE_TOKENIZE_QUERY == FTS5_TOKENIZE_QUERY && NGRAM_CORE_TOKENIZE_DOCUMENT == FTS5_TOKENIZE_DOCUMENT
+              && NGRAM_CORE_TOKENIZE_AUX == FTS5_TOKENIZE_AUX, "ngram_core flags must match FTS5_TOKENIZE_*");
+static_assert(NGRAM_CORE_TOKEN_COLOCATED == FTS5_TOKEN_COLOCATED, "ngram_core token flags must match FTS5_TOKEN_*");
 
-#define MIN_GRAM        1   /* Essentially strstr(3) */
-#define MAX_GRAM        4
-#define DEFAULT_GRAM    2
-
-typedef struct {
-    int ngram;
-    bool case_sensitive;
-} ngram_context_t;
+// Number of document tokenizer passes truncated by the max_tokens budget, process-wide
+//  FTS5 tokenizes a document again on UPDATE/DELETE, 'rebuild' and 'integrity-check', which the tokenizer can't tell apart.
+static std::atomic<sqlite3_int64> truncated_passes(0);
 
 /**
  * [qt.]
@@ -84,47 +94,13 @@ static int ngram_cb_create(void *pCtx, const char **azArg, int nArg, Fts5Tokeniz
     auto *pFts5Api = (fts5_api *) pCtx;
     UNUSED(pFts5Api);
 
-    auto *ctx = (ngram_context_t *) sqlite3_malloc(sizeof(ngram_context_t));
-    if (ctx == nullptr) {
-        LOG(ERROR) << "sqlite3_malloc() fail, size: " << sizeof(*ctx);
-        return SQLITE_NOMEM;
-    }
-    (void) memset(ctx, 0, sizeof(*ctx));
-
-    ctx->ngram = DEFAULT_GRAM;
-    for (int i = 0; i < nArg; i++) {
-        if (!strcmp(azArg[i], "gram")) {
-            if (++i >= nArg) {
-                LOG(ERROR) << "gram expected one argument, got nothing.";
-                goto out_fail;
-            }
-
-            int gram;
-            if (!ngram_tokenizer::parse_int(azArg[i], '\0', 10, &gram)) {
-                LOG(ERROR) << "parse_int() fail, str: " << azArg[i];
-                goto out_fail;
-            }
-            if (gram < MIN_GRAM || gram > MAX_GRAM) {
-                LOG(ERROR) << gram << "-gram is out of range, should in range [" << MIN_GRAM << ", " << MAX_GRAM << "]";
-                goto out_fail;
-            }
-            ctx->ngram = gram;
-        } else if (!strcmp(azArg[i], "case_sensitive")) {
-            ctx->case_sensitive = true;
-        } else {
-            LOG(ERROR) << "unrecognizable option at index " << i << ": " << azArg[i];
-            goto out_fail;
-        }
+    ngram_core_config *cfg = ngram_core_config_new(azArg, nArg);
+    if (cfg == nullptr) {
+        return SQLITE_ERROR;
     }
 
-    DLOG(INFO) << "ngram = " << ctx->ngram;
-    DLOG(INFO) << "case_sensitive = " << ctx->case_sensitive;
-    *ppOut = (Fts5Tokenizer *) ctx;
+    *ppOut = (Fts5Tokenizer *) cfg;
     return SQLITE_OK;
-
-    out_fail:
-    sqlite3_free(ctx);
-    return SQLITE_ERROR;
 }
 
 /**
@@ -136,52 +112,7 @@ static void ngram_cb_delete(Fts5Tokenizer *pTok) {
     DLOG(INFO) << "Freeing FTS5 " LIBNAME " tokenizer...";
 
     CHECK_NOTNULL(pTok);
-    auto *ctx = (ngram_context_t *) pTok;
-    DLOG(INFO) << "pTok: " << ctx << " ngram: " << ctx->ngram;
-
-    sqlite3_free(ctx);
-
-#ifndef DEBUG
-    google::ShutdownGoogleLogging();
-#endif
-}
-
-typedef int (*xTokenCallback)(
-        void *pCtx,         /* Copy of 2nd argument to xTokenize() */
-        int tflags,         /* Mask of FTS5_TOKEN_* flags */
-        const char *pToken, /* Pointer to buffer containing token */
-        int nToken,         /* Size of token in bytes */
-        int iStart,         /* Byte offset of token within input text */
-        int iEnd            /* Byte offset of end of token within input text */
-);
-
-static inline void do_tokenize(
-        const std::vector<ngram_tokenizer::Token> &arr,
-        size_t last_index,
-        xTokenCallback xToken,
-        ngram_context_t *ctx,
-        void *pCtx) {
-    static size_t first_index = 0;
-
-    int iStart = arr[first_index].get_iStart();
-    int iEnd = arr[last_index].get_iEnd();
-    CHECK_LT(iStart, iEnd);
-
-    std::stringstream ss;
-    for (size_t i = first_index; i <= last_index; i++) {
-        ss << arr[i].get_str();
-    }
-    std::string s = ss.str();
-
-    if (!ctx->case_sensitive) {
-        // https://stackoverflow.com/questions/313970/how-to-convert-an-instance-of-stdstring-to-lower-case/313990#313990
-        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
-    }
-
-    DLOG(INFO) << "> result token = '" << s << "'"
-               << " iStart = " << iStart
-               << " iEnd = " << iEnd;
-    xToken(pCtx, 0, s.c_str(), (int) s.length(), iStart, iEnd);
+    ngram_core_config_free((ngram_core_config *) pTok);
 }
 
 /**
@@ -198,7 +129,7 @@ static int ngram_cb_tokenize(
         int flags,          /* Mask of FTS5_TOKENIZE_* flags */
         const char *pText,
         int nText,
-        xTokenCallback xToken) {
+        ngram_tokenizer::xTokenCallback xToken) {
     CHECK_NOTNULL(pTok);
     CHECK_NOTNULL(pCtx);
     CHECK_NOTNULL(pText);
@@ -208,99 +139,56 @@ static int ngram_cb_tokenize(
     auto *pFts5Api = (fts5_api *) pCtx;
     UNUSED(pFts5Api);
 
-    auto *ctx = (ngram_context_t *) pTok;
-    DLOG(INFO) << ctx->ngram << "-gram tokenizing ...";
     DLOG(INFO) << "pTok: " << pTok << " pCtx: " << pCtx << " flags: " << flags;
     // [quote] ... pText may or may not be nul-terminated.
     DLOG(INFO) << "nText: " << nText << " pText: " << std::string(pText, 0, nText);
     DLOG(INFO) << "xToken: " << xToken;
 
-    if (ngram_tokenizer::utf8_validatestr(reinterpret_cast<const u_int8_t *>(pText), nText) != 0) {
-        LOG(ERROR) << "Met invalid UTF-8 character(s) in the input text, please check the text or issue a bug report";
-        return SQLITE_ERROR;
-    }
+    NGRAM_PROBE3(tokenize_entry, pTok, flags, nText);
 
-    auto tv = ngram_tokenizer::TokenVector(pText, nText);
-    if (!tv.tokenize()) {
-        return SQLITE_ERROR;
-    }
-    for (const auto &t: tv.get_tokens()) {
-        DLOG(INFO) << "> token = '" << t.get_str()
-                   << "' iStart = " << t.get_iStart()
-                   << " iEnd = " << t.get_iEnd()
-                   << " category = " << t.get_category();
+    int truncated;
+    int rc = ngram_core_tokenize((const ngram_core_config *) pTok, flags, pText, nText, pCtx, xToken, &truncated);
+    if (truncated && (flags & FTS5_TOKENIZE_DOCUMENT)) {
+        truncated_passes++;
     }
 
-    const std::vector<ngram_tokenizer::Token> &tokens = tv.get_tokens();
-
-    std::vector<ngram_tokenizer::Token> prevArr;
-    for (size_t i = 0; i < tokens.size(); i++) {
-        std::vector<ngram_tokenizer::Token> arr;
-
-        ngram_tokenizer::token_category_t prev_category;
-        for (int j = 0; j < ctx->ngram; j++) {
-            // Avoid out of array boundary
-            if (i + j >= tokens.size()) {
-                if (tokens.size() >= (size_t) ctx->ngram) {
-                    bool same_category = true;
-
-                    for (int k = 0; k < ctx->ngram; k++) {
-                        ngram_tokenizer::token_category_t category = tokens[tokens.size() - k - 1].get_category();
-                        if (k != 0) {
-                            if (category != prev_category) {
-                                same_category = false;
-                                break;
-                            }
-                        }
-                        prev_category = category;
-                    }
-
-                    // Same category meaning previously last ngram token had been added
-                    // Thus we don't need to cut again(unless they're in different categories)
-                    if (same_category) {
-                        DLOG(INFO)
-                                << "Don't do tokenize for the last N non-complete terms since they're in a same category";
-                        arr.clear();
-                    }
-                }
-
-                break;
-            }
-
-            const auto &curr_token = tokens[i + j];
-
-            if (j != 0) {
-                if (curr_token.get_category() != ngram_tokenizer::OTHER) {
-                    break;
-                }
-                if (curr_token.get_category() != prev_category) {
-                    break;
-                }
-            }
-
-            arr.emplace_back(curr_token);
-            prev_category = curr_token.get_category();
-        }
+    NGRAM_PROBE2(tokenize_return, rc, truncated);
+    return rc;
+}
 
-        if (!arr.empty()) {
-            // Temporarily solution to the input text case 'Hello世界'
-            if (prevArr.size() == 1 && prevArr[0].get_category() != ngram_tokenizer::OTHER &&
-                arr[0].get_category() == ngram_tokenizer::OTHER) {
-                for (size_t u = 0; u + 1 < arr.size(); u++) {
-                    DLOG(INFO) << "--- " << (u + 1);
-                    for (size_t v = 0; v <= u; v++) {
-                        do_tokenize(arr, v, xToken, ctx, pCtx);
-                    }
-                }
-            }
-
-            do_tokenize(arr, arr.size() - 1, xToken, ctx, pCtx);
-
-            prevArr = std::move(arr);
-        }
+/**
+ * SQL function ngram_truncated_count()
+ *  Return how many document tokenizer passes had been truncated by the max_tokens option since the extension loaded,
+ *  including the passes of deleted/updated rows, 'rebuild' and 'integrity-check'.
+ */
+static void ngram_truncated_count(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    UNUSED(nVal, apVal);
+    sqlite3_result_int64(pCtx, truncated_passes.load());
+}
+
+/**
+ * SQL function ngram_dict_compile(words_path, out_path)
+ *  Compile a word list(one word per line) into a double-array file which can be mmap(2)-ed by the dict option.
+ *  Return the double-array unit count.
+ */
+static void ngram_dict_compile(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_EQ(nVal, 2);
+
+    auto words_path = (const char *) sqlite3_value_text(apVal[0]);
+    auto out_path = (const char *) sqlite3_value_text(apVal[1]);
+    if (words_path == nullptr || out_path == nullptr) {
+        sqlite3_result_error(pCtx, "expected non-NULL paths to function " LIBNAME "_dict_compile()", -1);
+        return;
     }
 
-    return SQLITE_OK;
+    ngram_tokenizer::DoubleArrayTrie dict;
+    if (!dict.load(words_path)) {
+        sqlite3_result_error(pCtx, "cannot load word list", -1);
+    } else if (!dict.save(out_path)) {
+        sqlite3_result_error(pCtx, "cannot write double-array file", -1);
+    } else {
+        sqlite3_result_int64(pCtx, (sqlite3_int64) dict.get_size());
+    }
 }
 
 static fts5_tokenizer token_handle = {
@@ -325,11 +213,17 @@ int sqlite3_ngram_init(
         sqlite3 *db,
         char **pzErrMsg,
         const sqlite3_api_routines *pApi) {
+#ifdef NGRAM_GLOG_INIT
+    // Opt-in only: the failure signal handler replaces the host process' signal handlers
+    //  and glog may only be initialized once per process.
+    static std::once_flag glog_once;
+    std::call_once(glog_once, []() {
 #ifndef DEBUG
-    google::InitGoogleLogging(LIBNAME);
+        google::InitGoogleLogging(LIBNAME);
+#endif
+        google::InstallFailureSignalHandler();
+    });
 #endif
-
-    google::InstallFailureSignalHandler();
 
     CHECK_NOTNULL(db);
     CHECK_NOTNULL(pzErrMsg);
@@ -339,10 +233,10 @@ int sqlite3_ngram_init(
     //  so all sqlite3_*() functions can be used.
     SQLITE_EXTENSION_INIT2(pApi)
 
-    LOG(INFO) << "HEAD commit: " << BUILD_HEAD_COMMIT;
-    LOG(INFO) << "Built by " << BUILD_USER << " at " << BUILD_TIMESTAMP;
-    LOG(INFO) << "SQLite3 compile-time version: " << SQLITE_VERSION;
-    LOG(INFO) << "SQLite3 run-time version: " << sqlite3_libversion();
+    DLOG(INFO) << "HEAD commit: " << BUILD_HEAD_COMMIT;
+    DLOG(INFO) << "Built by " << BUILD_USER << " at " << BUILD_TIMESTAMP;
+    DLOG(INFO) << "SQLite3 compile-time version: " << SQLITE_VERSION;
+    DLOG(INFO) << "SQLite3 run-time version: " << sqlite3_libversion();
 
     fts5_api *pFts5Api = fts5_api_from_db(db);
     if (pFts5Api == nullptr) {
@@ -357,5 +251,38 @@ int sqlite3_ngram_init(
     if (rc == SQLITE_OK) {
         rc = pFts5Api->xCreateFunction(pFts5Api, LIBNAME "_highlight", pFts5Api, ngram_highlight, nullptr);
     }
+    if (rc == SQLITE_OK) {
+        rc = pFts5Api->xCreateFunction(pFts5Api, LIBNAME "_rank", pFts5Api, ngram_rank, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = pFts5Api->xCreateFunction(pFts5Api, LIBNAME "_fuzzy_rank", pFts5Api, ngram_fuzzy_rank, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_truncated_count", 0, SQLITE_UTF8, nullptr,
+                                     ngram_truncated_count, nullptr, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_like_init(db);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_regex_init(db);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_similarity_init(db);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_minhash_init(db);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_plan_init(db, pFts5Api);
+    }
+    if (rc == SQLITE_OK) {
+        rc = ngram_profile_init(db);
+    }
+    if (rc == SQLITE_OK) {
+        // Writes files, thus disallow it from triggers, views and schema
+        rc = sqlite3_create_function(db, LIBNAME "_dict_compile", 2, SQLITE_UTF8 | SQLITE_DIRECTONLY, nullptr,
+                                     ngram_dict_compile, nullptr, nullptr);
+    }
     return rc;
 }
@@ -0,0 +1,33 @@
+#pragma once
+
+// see:
+//  7.1. Custom Tokenizers
+//  https://sqlite.org/fts5.html#custom_tokenizers
+
+#define MIN_GRAM        1   /* Essentially strstr(3) */
+#define MAX_GRAM        4
+#define DEFAULT_GRAM    2
+
+/* Internal status of ngram_core(see ngram_core.h): the max_tokens budget is reached, equal to SQLITE_DONE */
+#define NGRAM_CORE_DONE         101
+
+#define NGRAM_JSON_OFF          0
+#define NGRAM_JSON_VALUES       1   /* Tokenize JSON string/number values only */
+#define NGRAM_JSON_KEYS_VALUES  2   /* Also emit key path prefixed grams colocated with value grams */
+
+namespace ngram_tokenizer {
+    class DoubleArrayTrie;
+}
+
+typedef struct {
+    int ngram;
+    bool case_sensitive;
+    int max_tokens;     /* Per-document gram budget, 0 means unlimited */
+    bool grapheme;      /* Use extended grapheme cluster(instead of code point) as the character unit */
+    int json;           /* NGRAM_JSON_*, documents are JSON texts */
+    ngram_tokenizer::DoubleArrayTrie *dict; /* User dictionary, nullptr if not specified */
+} ngram_context_t;
+
+namespace ngram_tokenizer {
+    bool parse_options(const char **, int, ngram_context_t *, const char **);
+}
@@ -0,0 +1,343 @@
+/**
+ * ngram_core: the n-gram tokenization engine without SQLite, see ngram_core.h
+ *
+ * see: LICENSE.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+#include "ngram_core.h"
+#include "utils.h"
+#include "ngram_context.h"
+#include "gram_stream.h"
+#include "dict_segmenter.h"
+#include "json_segmenter.h"
+#include "double_array_trie.h"
+#include "resource_registry.h"
+
+struct ngram_core_config {
+    ngram_context_t ctx;
+};
+
+namespace ngram_tokenizer {
+    /**
+     * Parse ngram tokenizer arguments
+     *
+     * @opts        where to store parsed options, dict is left untouched
+     * @dict_path   where to store the dict argument, untouched if not specified
+     * @return      true if parsed successfully, false otherwise.
+     */
+    bool parse_options(const char **azArg, int nArg, ngram_context_t *opts, const char **dict_path) {
+        CHECK(azArg != nullptr || nArg == 0);
+        CHECK_GE(nArg, 0);
+        CHECK_NOTNULL(opts);
+        CHECK_NOTNULL(dict_path);
+
+        opts->ngram = DEFAULT_GRAM;
+        for (int i = 0; i < nArg; i++) {
+            if (!strcmp(azArg[i], "gram")) {
+                if (++i >= nArg) {
+                    LOG(ERROR) << "gram expected one argument, got nothing.";
+                    return false;
+                }
+
+                int gram;
+                if (!ngram_tokenizer::parse_int(azArg[i], '\0', 10, &gram)) {
+                    LOG(ERROR) << "parse_int() fail, str: " << azArg[i];
+                    return false;
+                }
+                if (gram < MIN_GRAM || gram > MAX_GRAM) {
+                    LOG(ERROR) << gram << "-gram is out of range, should in range [" << MIN_GRAM << ", " << MAX_GRAM << "]";
+                    return false;
+                }
+                opts->ngram = gram;
+            } else if (!strcmp(azArg[i], "max_tokens")) {
+                if (++i >= nArg) {
+                    LOG(ERROR) << "max_tokens expected one argument, got nothing.";
+                    return false;
+                }
+
+                int max_tokens;
+                if (!ngram_tokenizer::parse_int(azArg[i], '\0', 10, &max_tokens)) {
+                    LOG(ERROR) << "parse_int() fail, str: " << azArg[i];
+                    return false;
+                }
+                if (max_tokens <= 0) {
+                    LOG(ERROR) << "max_tokens should be a positive number, got " << max_tokens;
+                    return false;
+                }
+                opts->max_tokens = max_tokens;
+            } else if (!strcmp(azArg[i], "case_sensitive")) {
+                opts->case_sensitive = true;
+            } else if (!strcmp(azArg[i], "grapheme")) {
+                opts->grapheme = true;
+            } else if (!strcmp(azArg[i], "json")) {
+                if (++i >= nArg) {
+                    LOG(ERROR) << "json expected one argument, got nothing.";
+                    return false;
+                }
+
+                if (!strcmp(azArg[i], "values")) {
+                    opts->json = NGRAM_JSON_VALUES;
+                } else if (!strcmp(azArg[i], "keys+values")) {
+                    opts->json = NGRAM_JSON_KEYS_VALUES;
+                } else {
+                    LOG(ERROR) << "json should be values or keys+values, got " << azArg[i];
+                    return false;
+                }
+            } else if (!strcmp(azArg[i], "dict")) {
+                if (++i >= nArg) {
+                    LOG(ERROR) << "dict expected one argument, got nothing.";
+                    return false;
+                }
+                *dict_path = azArg[i];
+            } else {
+                LOG(ERROR) << "unrecognizable option at index " << i << ": " << azArg[i];
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+}
+
+// Immutable resources shared by all configs(i.e. connections and tables), see resource_registry.h
+static ngram_tokenizer::ResourceRegistry<ngram_tokenizer::DoubleArrayTrie> dict_registry;
+static ngram_tokenizer::ResourceRegistry<ngram_core_config> config_registry;
+
+static void destroy_dict(ngram_tokenizer::DoubleArrayTrie *dict) {
+    delete dict;
+}
+
+static void destroy_config(ngram_core_config *cfg) {
+    if (cfg->ctx.dict != nullptr) {
+        dict_registry.release(cfg->ctx.dict, destroy_dict);
+    }
+    delete cfg;
+}
+
+/**
+ * Dictionary files are identified by their real path, size and modification time
+ *  thus an updated dictionary won't be confused with the stale one still in use.
+ */
+static bool dict_resource_key(const char *path, std::string &key) {
+    char *resolved = realpath(path, nullptr);
+    if (resolved == nullptr) {
+        LOG(ERROR) << "realpath() fail, path: " << path << " errno: " << errno;
+        return false;
+    }
+
+    struct stat st{};
+    int e = stat(resolved, &st);
+    if (e != 0) {
+        LOG(ERROR) << "stat() fail, path: " << resolved << " errno: " << errno;
+    } else {
+        std::ostringstream ss;
+        ss << resolved << "@" << st.st_size << "@" << st.st_mtime;
+        key = ss.str();
+    }
+    free(resolved);
+    return e == 0;
+}
+
+/**
+ * Create a config from tokenizer arguments
+ *
+ * @return  nullptr if the arguments are invalid or the dictionary cannot be loaded
+ */
+ngram_core_config *ngram_core_config_new(const char **azArg, int nArg) {
+    // Public C API, invalid arguments are reported instead of aborting the host process
+    if (nArg < 0 || (azArg == nullptr && nArg != 0)) {
+        LOG(ERROR) << "Invalid arguments, azArg: " << (const void *) azArg << " nArg: " << nArg;
+        return nullptr;
+    }
+
+    ngram_context_t opts;
+    (void) memset(&opts, 0, sizeof(opts));
+    const char *dict_path = nullptr;
+    std::string dict_key;
+
+    if (!ngram_tokenizer::parse_options(azArg, nArg, &opts, &dict_path)) {
+        return nullptr;
+    }
+    if (dict_path != nullptr && !dict_resource_key(dict_path, dict_key)) {
+        return nullptr;
+    }
+
+    // Canonical option string, equivalent options share one immutable config
+    std::ostringstream ss;
+    ss << "gram=" << opts.ngram
+       << " case_sensitive=" << opts.case_sensitive
+       << " max_tokens=" << opts.max_tokens
+       << " grapheme=" << opts.grapheme
+       << " json=" << opts.json
+       << " dict=" << dict_key;
+
+    ngram_core_config *cfg = config_registry.acquire(ss.str(), [&]() -> ngram_core_config * {
+        if (dict_path != nullptr) {
+            opts.dict = dict_registry.acquire(dict_key, [&]() -> ngram_tokenizer::DoubleArrayTrie * {
+                auto dict = new(std::nothrow) ngram_tokenizer::DoubleArrayTrie();
+                if (dict == nullptr) {
+                    LOG(ERROR) << "Cannot allocate double-array trie";
+                } else if (!dict->load(dict_path)) {
+                    LOG(ERROR) << "Cannot load dictionary: " << dict_path;
+                    delete dict;
+                    dict = nullptr;
+                }
+                return dict;
+            });
+            if (opts.dict == nullptr) {
+                return nullptr;
+            }
+        }
+
+        auto p = new(std::nothrow) ngram_core_config();
+        if (p == nullptr) {
+            LOG(ERROR) << "Cannot allocate config, size: " << sizeof(*p);
+            if (opts.dict != nullptr) {
+                dict_registry.release(opts.dict, destroy_dict);
+            }
+            return nullptr;
+        }
+        p->ctx = opts;
+        return p;
+    });
+    if (cfg == nullptr) {
+        return nullptr;
+    }
+
+    DLOG(INFO) << "ngram = " << cfg->ctx.ngram;
+    DLOG(INFO) << "case_sensitive = " << cfg->ctx.case_sensitive;
+    DLOG(INFO) << "max_tokens = " << cfg->ctx.max_tokens;
+    DLOG(INFO) << "grapheme = " << cfg->ctx.grapheme;
+    DLOG(INFO) << "json = " << cfg->ctx.json;
+    DLOG(INFO) << "dict = " << cfg->ctx.dict;
+    return cfg;
+}
+
+void ngram_core_config_free(ngram_core_config *cfg) {
+    if (cfg != nullptr) {
+        config_registry.release(cfg, destroy_config);
+    }
+}
+
+/**
+ * Tokenize text, xToken() is invoked for each token in order
+ *
+ * @return  NGRAM_CORE_OK if the input is exhausted(or empty) or the max_tokens budget is reached,
+ *          NGRAM_CORE_ERROR if an argument is invalid or met non-UTF8 character,
+ *          otherwise the first non-NGRAM_CORE_OK value returned by xToken().
+ */
+int ngram_core_tokenize(
+        const ngram_core_config *cfg,
+        int flags,
+        const char *pText,
+        int nText,
+        void *pCtx,
+        ngram_core_token_cb xToken,
+        int *pbTruncated) {
+    if (pbTruncated != nullptr) *pbTruncated = 0;
+
+    // An empty Go slice or Rust &[] is passed as (NULL, 0)
+    if (cfg == nullptr || xToken == nullptr || nText < 0 || (pText == nullptr && nText != 0)) {
+        LOG(ERROR) << "Invalid arguments, cfg: " << (const void *) cfg << " pText: " << (const void *) pText
+                   << " nText: " << nText;
+        return NGRAM_CORE_ERROR;
+    }
+    if (nText == 0) {
+        return NGRAM_CORE_OK;
+    }
+
+    if (ngram_tokenizer::utf8_validatestr(reinterpret_cast<const u_int8_t *>(pText), nText) != 0) {
+        LOG(ERROR) << "Met invalid UTF-8 character(s) in the input text, please check the text or issue a bug report";
+        return NGRAM_CORE_ERROR;
+    }
+
+    // Queries are never truncated, otherwise they'd match far more loosely than intended
+    //  documents and highlight(aux) share the same budget, thus token offsets stay consistent.
+    const ngram_context_t *ctx = &cfg->ctx;
+    int max_tokens = (flags & NGRAM_CORE_TOKENIZE_QUERY) ? 0 : ctx->max_tokens;
+
+    int rc;
+    bool truncated;
+    if (ctx->json != NGRAM_JSON_OFF) {
+        auto js = ngram_tokenizer::JsonSegmenter(pText, nText, ctx, max_tokens, (flags & NGRAM_CORE_TOKENIZE_QUERY) != 0);
+        rc = js.run(pCtx, xToken);
+        truncated = js.is_truncated();
+    } else if (ctx->dict != nullptr) {
+        auto ds = ngram_tokenizer::DictSegmenter(pText, nText, ctx, max_tokens);
+        rc = ds.run(pCtx, xToken);
+        truncated = ds.is_truncated();
+    } else {
+        auto gs = ngram_tokenizer::GramStream(pText, nText, ctx, max_tokens);
+        rc = gs.run(pCtx, xToken);
+        truncated = gs.is_truncated();
+    }
+
+    if (truncated) {
+        DLOG(INFO) << "Text truncated after " << max_tokens << " grams";
+        if (pbTruncated != nullptr) *pbTruncated = 1;
+    }
+    return rc;
+}
+
+typedef struct {
+    ngram_core_token *aToken;
+    int nTokenMax;
+    int nToken;
+    char *pBuf;
+    int nBufMax;
+    int nBuf;
+} BufferCtx;
+
+static int buffer_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+    auto p = (BufferCtx *) pCtx;
+    // Keep counting once full, so the caller learns the sizes required
+    if (p->nToken < p->nTokenMax && nToken <= p->nBufMax - p->nBuf) {
+        p->aToken[p->nToken] = {p->nBuf, nToken, iStart, iEnd, tflags};
+        (void) memcpy(p->pBuf + p->nBuf, pToken, nToken);
+    }
+    if (p->nToken == INT_MAX || nToken > INT_MAX - p->nBuf) {
+        return NGRAM_CORE_NOMEM;
+    }
+    p->nToken++;
+    p->nBuf += nToken;
+    return NGRAM_CORE_OK;
+}
+
+/**
+ * Tokenize text into caller-supplied buffers, see ngram_core_tokenize()
+ */
+int ngram_core_tokenize_buffer(
+        const ngram_core_config *cfg,
+        int flags,
+        const char *pText,
+        int nText,
+        ngram_core_token *aToken,
+        int *pnToken,
+        char *pBuf,
+        int *pnBuf) {
+    if (pnToken == nullptr || pnBuf == nullptr || *pnToken < 0 || *pnBuf < 0 ||
+        (aToken == nullptr && *pnToken != 0) || (pBuf == nullptr && *pnBuf != 0)) {
+        LOG(ERROR) << "Invalid token buffer arguments";
+        return NGRAM_CORE_ERROR;
+    }
+
+    BufferCtx ctx = {aToken, *pnToken, 0, pBuf, *pnBuf, 0};
+    int rc = ngram_core_tokenize(cfg, flags, pText, nText, &ctx, buffer_cb, nullptr);
+    if (rc == NGRAM_CORE_OK && (ctx.nToken > ctx.nTokenMax || ctx.nBuf > ctx.nBufMax)) {
+        rc = NGRAM_CORE_FULL;
+    }
+    *pnToken = ctx.nToken;
+    *pnBuf = ctx.nBuf;
+    return rc;
+}
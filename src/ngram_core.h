@@ -0,0 +1,91 @@
+/**
+ * ngram_core: the n-gram tokenization engine without SQLite
+ *
+ *  ngram_core_config *cfg = ngram_core_config_new(azArg, nArg);   // {"gram", "2", "case_sensitive"}
+ *  ngram_core_tokenize(cfg, NGRAM_CORE_TOKENIZE_DOCUMENT, text, n, ctx, on_token, NULL);
+ *  ngram_core_config_free(cfg);
+ *
+ * Arguments are the same as the FTS5 tokenize option, configs of equal options share one immutable instance,
+ * a config may be used by multiple threads concurrently.
+ *
+ * see: LICENSE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes, numerically equal to their SQLite counterparts */
+#define NGRAM_CORE_OK       0
+#define NGRAM_CORE_ERROR    1       /* Invalid argument or non-UTF-8 input */
+#define NGRAM_CORE_NOMEM    7
+#define NGRAM_CORE_FULL     13      /* Caller-supplied buffer is too small, see ngram_core_tokenize_buffer() */
+
+/* Tokenize flags, numerically equal to FTS5_TOKENIZE_* */
+#define NGRAM_CORE_TOKENIZE_QUERY       0x0001  /* Queries are never truncated by max_tokens */
+#define NGRAM_CORE_TOKENIZE_PREFIX      0x0002
+#define NGRAM_CORE_TOKENIZE_DOCUMENT    0x0004
+#define NGRAM_CORE_TOKENIZE_AUX         0x0008
+
+/* Token flags, numerically equal to FTS5_TOKEN_* */
+#define NGRAM_CORE_TOKEN_COLOCATED      0x0001  /* Same position as the previous token, e.g. json keys+values path tokens */
+
+typedef struct ngram_core_config ngram_core_config;
+
+/*
+** Token callback, returning anything other than NGRAM_CORE_OK stops the tokenization
+**  and ngram_core_tokenize() returns that value. pToken is only valid during the call.
+*/
+typedef int (*ngram_core_token_cb)(
+        void *pCtx,         /* Copy of the pCtx argument to ngram_core_tokenize() */
+        int tflags,         /* Mask of NGRAM_CORE_TOKEN_* flags */
+        const char *pToken, /* Pointer to buffer containing token */
+        int nToken,         /* Size of token in bytes */
+        int iStart,         /* Byte offset of token within input text */
+        int iEnd            /* Byte offset of end of token within input text */
+);
+
+/*
+** A token written by ngram_core_tokenize_buffer(), its bytes are pBuf[iOff, iOff + nToken)
+*/
+typedef struct {
+    int iOff;
+    int nToken;
+    int iStart;
+    int iEnd;
+    int tflags;     /* Mask of NGRAM_CORE_TOKEN_* flags */
+} ngram_core_token;
+
+ngram_core_config *ngram_core_config_new(const char **azArg, int nArg);
+
+void ngram_core_config_free(ngram_core_config *cfg);
+
+int ngram_core_tokenize(
+        const ngram_core_config *cfg,
+        int flags,                  /* Mask of NGRAM_CORE_TOKENIZE_* flags */
+        const char *pText,          /* May be NULL if nText is 0 */
+        int nText,
+        void *pCtx,
+        ngram_core_token_cb xToken,
+        int *pbTruncated            /* Set to whether max_tokens truncated the text, may be NULL */
+);
+
+/*
+** Return NGRAM_CORE_FULL if aToken or pBuf is too small, *pnToken and *pnBuf are then set to the sizes required.
+*/
+int ngram_core_tokenize_buffer(
+        const ngram_core_config *cfg,
+        int flags,                  /* Mask of NGRAM_CORE_TOKENIZE_* flags */
+        const char *pText,          /* May be NULL if nText is 0 */
+        int nText,
+        ngram_core_token *aToken,   /* Caller-supplied token array */
+        int *pnToken,               /* In: capacity of aToken, out: tokens produced */
+        char *pBuf,                 /* Caller-supplied token bytes buffer */
+        int *pnBuf                  /* In: capacity of pBuf, out: bytes produced */
+);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,153 @@
+#include <cctype>
+#include <cstring>
+#include <glog/logging.h>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+#include "options.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+namespace ngram_tokenizer {
+    /**
+     * Scan a bareword or a quoted word('...', "...", `...` or [...]) at *pz, like fts5ConfigGobbleWord()
+     *
+     * @return  the dequoted word, *pz is advanced past it
+     */
+    static std::string gobble_word(const char **pz) {
+        const char *z = *pz;
+        std::string word;
+
+        char quote = *z;
+        if (quote == '[') quote = ']';
+        if (quote == '\'' || quote == '"' || quote == '`' || quote == ']') {
+            for (z++; *z != '\0'; z++) {
+                if (*z == quote) {
+                    // A doubled quote is an escaped quote
+                    if (quote != ']' && z[1] == quote) {
+                        z++;
+                    } else {
+                        z++;
+                        break;
+                    }
+                }
+                word += *z;
+            }
+        } else {
+            while (*z != '\0' && !isspace((unsigned char) *z) && *z != ',' && *z != ')' && *z != '=') {
+                word += *z++;
+            }
+        }
+
+        *pz = z;
+        return word;
+    }
+
+    static inline const char *skip_space(const char *z) {
+        while (isspace((unsigned char) *z)) z++;
+        return z;
+    }
+
+    /**
+     * Read the tokenize argument of an FTS5 table from its CREATE VIRTUAL TABLE statement
+     *
+     * @words       where to store the tokenizer name followed by its arguments, e.g. {"porter", "ngram", "gram", "2"}
+     * @return      false if the table is not an FTS5 table
+     */
+    bool table_tokenizer(sqlite3 *db, const char *zTable, std::vector<std::string> &words) {
+        CHECK_NOTNULL(db);
+        CHECK_NOTNULL(zTable);
+
+        sqlite3_stmt *pStmt = nullptr;
+        std::string sql;
+        int rc = sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE type = 'table' AND name = ?1",
+                                    -1, &pStmt, nullptr);
+        if (rc == SQLITE_OK) {
+            (void) sqlite3_bind_text(pStmt, 1, zTable, -1, SQLITE_STATIC);
+            if (sqlite3_step(pStmt) == SQLITE_ROW && sqlite3_column_text(pStmt, 0) != nullptr) {
+                sql = (const char *) sqlite3_column_text(pStmt, 0);
+            }
+        }
+        (void) sqlite3_finalize(pStmt);
+
+        // CREATE VIRTUAL TABLE name USING fts5(arg, ..., tokenize = 'ngram ...', ...)
+        const char *z = strchr(sql.c_str(), '(');
+        const char *e = z;
+        while (e != nullptr && e > sql.c_str() && isspace((unsigned char) e[-1])) e--;
+        if (e == nullptr || e - sql.c_str() < 4 || strncasecmp(e - 4, "fts5", 4) != 0) {
+            LOG(ERROR) << zTable << " is not an FTS5 table";
+            return false;
+        }
+
+        std::string tokenize;
+        for (z = skip_space(z + 1); *z != '\0' && *z != ')'; z = skip_space(z)) {
+            std::string key = gobble_word(&z);
+            z = skip_space(z);
+            if (*z == '=') {
+                z = skip_space(z + 1);
+                std::string value = gobble_word(&z);
+                if (!strcasecmp(key.c_str(), "tokenize")) {
+                    tokenize = value;
+                }
+                z = skip_space(z);
+            }
+            if (*z == ',') {
+                z++;
+            } else if (*z != ')') {
+                // Unexpected token, skip it
+                if (*z != '\0') z++;
+            }
+        }
+
+        words.clear();
+        for (const char *w = skip_space(tokenize.c_str()); *w != '\0'; w = skip_space(w)) {
+            const char *p = w;
+            words.emplace_back(gobble_word(&w));
+            if (w == p) w++;
+        }
+        return true;
+    }
+
+    /**
+     * Read ngram tokenizer options of an FTS5 table from its CREATE VIRTUAL TABLE statement
+     *
+     * @opts        where to store parsed options, dict is left untouched
+     * @has_dict    where to store whether the table uses a dictionary
+     * @wrapped     where to store whether the tokenizer is wrapped by another one(e.g. porter), may be nullptr
+     * @return      false if the table is not an FTS5 table using the ngram tokenizer
+     */
+    bool table_options(sqlite3 *db, const char *zTable, ngram_context_t *opts, bool *has_dict, bool *wrapped) {
+        CHECK_NOTNULL(opts);
+        CHECK_NOTNULL(has_dict);
+
+        std::vector<std::string> words;
+        if (!table_tokenizer(db, zTable, words)) {
+            return false;
+        }
+
+        // Tokenizer may be wrapped, e.g. 'porter ngram gram 2'
+        size_t i = 0;
+        while (i < words.size() && words[i] != LIBNAME) i++;
+        if (i == words.size()) {
+            LOG(ERROR) << zTable << " doesn't use the " LIBNAME " tokenizer";
+            return false;
+        }
+        if (wrapped != nullptr) *wrapped = i != 0;
+
+        std::vector<const char *> azArg;
+        for (i++; i < words.size(); i++) {
+            azArg.push_back(words[i].c_str());
+        }
+        azArg.push_back(nullptr);
+
+        const char *dict_path = nullptr;
+        (void) memset(opts, 0, sizeof(*opts));
+        if (!parse_options(azArg.data(), (int) azArg.size() - 1, opts, &dict_path)) {
+            return false;
+        }
+        *has_dict = dict_path != nullptr;
+        return true;
+    }
+}
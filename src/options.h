@@ -0,0 +1,13 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+#include "ngram_context.h"
+
+#include <string>
+#include <vector>
+
+namespace ngram_tokenizer {
+    bool table_tokenizer(sqlite3 *, const char *, std::vector<std::string> &);
+
+    bool table_options(sqlite3 *, const char *, ngram_context_t *, bool *, bool *);
+}
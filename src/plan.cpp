@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glog/logging.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "plan.h"
+#include "like.h"
+#include "options.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// Selectivity-aware query rewriter
+//
+//  CREATE VIRTUAL TABLE t1_vocab USING fts5vocab(t1, row);
+//  SELECT * FROM t1 WHERE t1 MATCH ngram_plan('t1', '中华人民共和国');
+//
+// A phrase of M grams makes FTS5 read all M posting lists, FTS5 evaluates AND by seeking the other children
+//  to the rowids of the first one, thus the rewritten expression
+//
+//  "共和" AND "人民" AND "中华" AND "中华人民共和国"
+//
+// leads with the rarest grams, a subset of them still covering every character of the query, and the
+// original phrase comes last to keep the result exact.
+//
+// Document frequencies are read from an fts5vocab table and cached per process, the cache of a table
+// is dropped once its averages record(row and token counts) or structure record(segments, rewritten by
+// every committed write) changes. Within an explicit transaction the cache is bypassed, since pending
+// writes aren't in either record yet.
+// Cached frequencies only steer the order, the expression always ends with the phrase and stays exact.
+
+#define PLAN_MAX_TABLES     64      /* Max tables cached */
+#define PLAN_MAX_TERMS      65536   /* Max terms cached per table */
+
+/*
+** Cached document frequencies of a table
+*/
+struct PlanStats {
+    std::string version;    /* Averages and structure records of the table when cached */
+    std::unordered_map<std::string, sqlite3_int64> df;
+};
+
+static std::mutex plan_mutex;
+static std::map<std::string, PlanStats> plan_cache;
+
+typedef struct {
+    std::string term;
+    int iStart;
+    int iEnd;
+    sqlite3_int64 df;
+    bool single;    /* Whether the quoted term tokenizes back to itself */
+} PlanGram;
+
+typedef struct {
+    std::vector<PlanGram> *pGrams;
+    bool colocated;
+} PlanTokenCtx;
+
+static int plan_token_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+    auto p = (PlanTokenCtx *) pCtx;
+    if (tflags & FTS5_TOKEN_COLOCATED) {
+        p->colocated = true;
+    } else {
+        p->pGrams->push_back({std::string(pToken, nToken), iStart, iEnd, 0, false});
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Read the FTS5 averages(id 1) and structure(id 10) records, the former changes on every insert and delete,
+** the latter on every committed write(e.g. an UPDATE keeping the row and token counts)
+*/
+static int plan_version(sqlite3 *db, const char *zTable, std::string &version, sqlite3_int64 *pnRow) {
+    char *zSql = sqlite3_mprintf("SELECT id, block FROM \"%w_data\" WHERE id IN (1, 10) ORDER BY id", zTable);
+    if (zSql == nullptr) return SQLITE_NOMEM;
+
+    sqlite3_stmt *pStmt = nullptr;
+    int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, nullptr);
+    sqlite3_free(zSql);
+    version.clear();
+    *pnRow = 0;
+    while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+        int id = sqlite3_column_int(pStmt, 0);
+        auto p = (const unsigned char *) sqlite3_column_blob(pStmt, 1);
+        int n = sqlite3_column_bytes(pStmt, 1);
+        // Length-prefixed, so the two records can't run into each other
+        version += std::to_string(id) + ":" + std::to_string(n) + ":";
+        if (p != nullptr) {
+            version.append((const char *) p, n);
+        }
+        if (p != nullptr && id == 1) {
+            // Leading varint is the row count
+            sqlite3_uint64 v = 0;
+            for (int i = 0; i < n && i < 9; i++) {
+                if (i == 8) {
+                    v = (v << 8) | p[i];
+                    break;
+                }
+                v = (v << 7) | (p[i] & 0x7f);
+                if (!(p[i] & 0x80)) break;
+            }
+            *pnRow = (sqlite3_int64) v;
+        }
+    }
+    int rc2 = sqlite3_finalize(pStmt);
+    return rc == SQLITE_OK ? rc2 : rc;
+}
+
+static std::string plan_cache_key(sqlite3 *db, const char *zTable) {
+    const char *zFile = sqlite3_db_filename(db, "main");
+    std::string key;
+    if (zFile == nullptr || *zFile == '\0') {
+        // In-memory or temporary database, private to the connection
+        char buf[32];
+        (void) snprintf(buf, sizeof(buf), "%p", (void *) db);
+        key = buf;
+    } else {
+        key = zFile;
+    }
+    key += '\0';
+    key += zTable;
+    return key;
+}
+
+/*
+** Fill in document frequencies, from the cache if possible
+*/
+static int plan_lookup_df(sqlite3 *db, const char *zTable, const char *zVocab, std::vector<PlanGram> &grams) {
+    // Pending writes of an open transaction aren't reflected by plan_version()
+    const bool cacheable = sqlite3_get_autocommit(db) != 0;
+    std::string version;
+    sqlite3_int64 nRow;
+    int rc = plan_version(db, zTable, version, &nRow);
+    if (rc != SQLITE_OK) return rc;
+
+    std::string key = plan_cache_key(db, zTable);
+    std::vector<size_t> missing;
+    {
+        std::lock_guard<std::mutex> lock(plan_mutex);
+        auto it = cacheable ? plan_cache.find(key) : plan_cache.end();
+        if (it != plan_cache.end() && it->second.version != version) {
+            plan_cache.erase(it);
+            it = plan_cache.end();
+        }
+        for (size_t i = 0; i < grams.size(); i++) {
+            if (it != plan_cache.end()) {
+                auto hit = it->second.df.find(grams[i].term);
+                if (hit != it->second.df.end()) {
+                    grams[i].df = hit->second;
+                    continue;
+                }
+            }
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()) return SQLITE_OK;
+
+    char *zSql = sqlite3_mprintf("SELECT sum(doc) FROM \"%w\" WHERE term = ?1", zVocab);
+    if (zSql == nullptr) return SQLITE_NOMEM;
+    sqlite3_stmt *pStmt = nullptr;
+    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, nullptr);
+    sqlite3_free(zSql);
+
+    for (size_t k = 0; rc == SQLITE_OK && k < missing.size(); k++) {
+        PlanGram &g = grams[missing[k]];
+        (void) sqlite3_bind_text(pStmt, 1, g.term.data(), (int) g.term.size(), SQLITE_STATIC);
+        if (sqlite3_step(pStmt) == SQLITE_ROW) {
+            g.df = sqlite3_column_int64(pStmt, 0);
+        }
+        rc = sqlite3_reset(pStmt);
+    }
+    (void) sqlite3_finalize(pStmt);
+    if (rc != SQLITE_OK || !cacheable) return rc;
+
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    if (plan_cache.size() >= PLAN_MAX_TABLES && plan_cache.find(key) == plan_cache.end()) {
+        plan_cache.clear();
+    }
+    PlanStats &stats = plan_cache[key];
+    if (stats.version != version) {
+        stats.version = version;
+        stats.df.clear();
+    }
+    if (stats.df.size() + missing.size() > PLAN_MAX_TERMS) {
+        stats.df.clear();
+    }
+    for (size_t i: missing) {
+        stats.df[grams[i].term] = grams[i].df;
+    }
+    return SQLITE_OK;
+}
+
+/*
+** The table's tokenizer, created once per ngram_plan() call
+*/
+typedef struct {
+    fts5_tokenizer api;
+    Fts5Tokenizer *pTok;
+} PlanTokenizer;
+
+static int plan_tokenizer_create(fts5_api *pFts5Api, const std::vector<std::string> &words, PlanTokenizer *p) {
+    void *pUserData = nullptr;
+    p->pTok = nullptr;
+    int rc = pFts5Api->xFindTokenizer(pFts5Api, words[0].c_str(), &pUserData, &p->api);
+    if (rc != SQLITE_OK) return rc;
+
+    std::vector<const char *> azArg;
+    for (size_t i = 1; i < words.size(); i++) {
+        azArg.push_back(words[i].c_str());
+    }
+    azArg.push_back(nullptr);
+
+    return p->api.xCreate(pUserData, azArg.data(), (int) azArg.size() - 1, &p->pTok);
+}
+
+static void plan_tokenizer_delete(PlanTokenizer *p) {
+    if (p->pTok != nullptr) {
+        p->api.xDelete(p->pTok);
+        p->pTok = nullptr;
+    }
+}
+
+/*
+** Tokenize text with the table's tokenizer in query mode
+*/
+static int plan_tokenize(PlanTokenizer *p, const char *zText, int nText, PlanTokenCtx *pTokCtx) {
+    return p->api.xTokenize(p->pTok, pTokCtx, FTS5_TOKENIZE_QUERY, zText, nText, plan_token_cb);
+}
+
+/**
+ * SQL function ngram_plan(table, query[, vocab])
+ *  Return a MATCH expression equivalent to the phrase query, vocab defaults to "<table>_vocab".
+ */
+static void ngram_plan(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_GE(nVal, 2);
+    auto pFts5Api = (fts5_api *) sqlite3_user_data(pCtx);
+    sqlite3 *db = sqlite3_context_db_handle(pCtx);
+
+    auto zTable = (const char *) sqlite3_value_text(apVal[0]);
+    auto zQuery = (const char *) sqlite3_value_text(apVal[1]);
+    int nQuery = sqlite3_value_bytes(apVal[1]);
+    if (zTable == nullptr || zQuery == nullptr) {
+        return;
+    }
+    std::string vocab = std::string(zTable) + "_vocab";
+    if (nVal > 2 && sqlite3_value_text(apVal[2]) != nullptr) {
+        vocab = (const char *) sqlite3_value_text(apVal[2]);
+    }
+
+    std::string phrase = ngram_tokenizer::quote_match_string(std::string(zQuery, nQuery));
+
+    ngram_context_t opts;
+    bool has_dict;
+    std::vector<std::string> words;
+    if (!ngram_tokenizer::table_options(db, zTable, &opts, &has_dict, nullptr) ||
+        !ngram_tokenizer::table_tokenizer(db, zTable, words) || words.empty()) {
+        sqlite3_result_error(pCtx, "not an FTS5 table using the " LIBNAME " tokenizer", -1);
+        return;
+    }
+
+    PlanTokenizer tokenizer;
+    int rc = plan_tokenizer_create(pFts5Api, words, &tokenizer);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(pCtx, rc);
+        return;
+    }
+
+    std::vector<PlanGram> grams;
+    PlanTokenCtx tokCtx = {&grams, false};
+    rc = plan_tokenize(&tokenizer, zQuery, nQuery, &tokCtx);
+    // Nothing to reorder, or colocated tokens which a single gram can't stand for
+    if (rc != SQLITE_OK || grams.size() <= 1 || tokCtx.colocated) {
+        plan_tokenizer_delete(&tokenizer);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error_code(pCtx, rc);
+        } else {
+            sqlite3_result_text(pCtx, phrase.c_str(), (int) phrase.size(), SQLITE_TRANSIENT);
+        }
+        return;
+    }
+
+    // A gram may only stand alone if it tokenizes back to itself(e.g. not the 'o世' of 'Hello世界')
+    for (auto &g: grams) {
+        std::vector<PlanGram> sub;
+        PlanTokenCtx subCtx = {&sub, false};
+        rc = plan_tokenize(&tokenizer, g.term.data(), (int) g.term.size(), &subCtx);
+        if (rc != SQLITE_OK) break;
+        g.single = !subCtx.colocated && sub.size() == 1 && sub[0].term == g.term;
+    }
+    plan_tokenizer_delete(&tokenizer);
+    if (rc == SQLITE_OK) {
+        rc = plan_lookup_df(db, zTable, vocab.c_str(), grams);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error(pCtx, sqlite3_errmsg(db), -1);
+        return;
+    }
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < grams.size(); i++) {
+        if (grams[i].single) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&grams](size_t a, size_t b) {
+        // Wider grams first on ties, they cover more of the query
+        if (grams[a].df != grams[b].df) return grams[a].df < grams[b].df;
+        return grams[a].iEnd - grams[a].iStart > grams[b].iEnd - grams[b].iStart;
+    });
+
+    std::string expr;
+    if (!order.empty() && grams[order[0]].df == 0) {
+        // No row contained it when counted, the phrase still keeps the result exact if that's stale
+        expr = ngram_tokenizer::quote_match_string(grams[order[0]].term) + " AND " + phrase;
+    } else {
+        // Greedy cover: rarest first, skip grams adding no uncovered byte
+        std::vector<bool> covered(nQuery, false);
+        for (size_t i: order) {
+            const PlanGram &g = grams[i];
+            bool useful = false;
+            for (int b = std::max(g.iStart, 0); b < g.iEnd && b < nQuery; b++) {
+                if (!covered[b]) {
+                    covered[b] = true;
+                    useful = true;
+                }
+            }
+            if (!useful) continue;
+
+            expr += ngram_tokenizer::quote_match_string(g.term) + " AND ";
+        }
+        expr += phrase;
+    }
+    DLOG(INFO) << "query: " << zQuery << " plan: " << expr;
+
+    sqlite3_result_text(pCtx, expr.c_str(), (int) expr.size(), SQLITE_TRANSIENT);
+}
+
+int ngram_plan_init(sqlite3 *db, fts5_api *pFts5Api) {
+    int rc = sqlite3_create_function(db, LIBNAME "_plan", 2, SQLITE_UTF8, (void *) pFts5Api,
+                                     ngram_plan, nullptr, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_plan", 3, SQLITE_UTF8, (void *) pFts5Api,
+                                     ngram_plan, nullptr, nullptr);
+    }
+    return rc;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+int ngram_plan_init(sqlite3 *, fts5_api *);
@@ -0,0 +1,40 @@
+#pragma once
+
+// USDT(SystemTap SDT) static probes, see bpftrace/ for sample scripts
+//
+// Compiled in only by the NGRAM_USDT build option(needs <sys/sdt.h>, e.g. from systemtap-sdt-dev),
+//  a probe site is a single nop until a tracer attaches, arguments are read from registers then.
+//
+//  provider    probe               arguments
+//  ngram       tokenize_entry      pTok, flags(FTS5_TOKENIZE_*), nText
+//  ngram       tokenize_return     rc, truncated
+//  ngram       gram                nToken, nUnit(characters in the gram), iStart, iEnd, kind(NGRAM_PROBE_*),
+//                                  tflags(FTS5_TOKEN_*)
+//  ngram       highlight_entry     nVal
+//  ngram       highlight_return    nVal
+//  ngram       highlight3_entry    iCol
+//  ngram       highlight3_return   rc, nIn
+//
+// see:
+//  https://sourceware.org/systemtap/wiki/AddingUserSpaceProbingToApps
+//  https://github.com/bpftrace/bpftrace/blob/master/man/adoc/bpftrace.adoc#usdt
+
+#define NGRAM_PROBE_GRAM    0   /* n-gram */
+#define NGRAM_PROBE_WORD    1   /* Dictionary word */
+#define NGRAM_PROBE_PATH    2   /* json keys+values key path prefixed token */
+
+#ifdef NGRAM_USDT
+#include <sys/sdt.h>
+
+#define NGRAM_PROBE1(name, a1)                          DTRACE_PROBE1(ngram, name, a1)
+#define NGRAM_PROBE2(name, a1, a2)                      DTRACE_PROBE2(ngram, name, a1, a2)
+#define NGRAM_PROBE3(name, a1, a2, a3)                  DTRACE_PROBE3(ngram, name, a1, a2, a3)
+#define NGRAM_PROBE5(name, a1, a2, a3, a4, a5)          DTRACE_PROBE5(ngram, name, a1, a2, a3, a4, a5)
+#define NGRAM_PROBE6(name, a1, a2, a3, a4, a5, a6)      DTRACE_PROBE6(ngram, name, a1, a2, a3, a4, a5, a6)
+#else
+#define NGRAM_PROBE1(name, a1)                          do {} while (0)
+#define NGRAM_PROBE2(name, a1, a2)                      do {} while (0)
+#define NGRAM_PROBE3(name, a1, a2, a3)                  do {} while (0)
+#define NGRAM_PROBE5(name, a1, a2, a3, a4, a5)          do {} while (0)
+#define NGRAM_PROBE6(name, a1, a2, a3, a4, a5, a6)      do {} while (0)
+#endif
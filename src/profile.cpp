@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "profile.h"
+#include "gram_stream.h"
+#include "options.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// Gram frequency profiler
+//
+//  SELECT ngram_profile(body) FROM articles;
+//  SELECT ngram_profile(body, 'case_sensitive max_tokens 4096') FROM articles;
+//
+// Every row is tokenized as a document for each gram size in [MIN_GRAM, MAX_GRAM], per gram size:
+//
+//  distinct    HyperLogLog estimate of the vocabulary size
+//  postings    exact gram occurrences, i.e. position list entries of the index
+//  top         heavy hitters tracked by a count-min sketch(conservative update), counts are upper bounds
+//
+// Memory is bounded regardless of the input size, about 132 KiB per gram size plus the heavy hitter candidates.
+//
+// see:
+//  Flajolet et al., HyperLogLog: the analysis of a near-optimal cardinality estimation algorithm
+//  Cormode, Muthukrishnan, An Improved Data Stream Summary: The Count-Min Sketch and its Applications
+
+#define HLL_BITS        12
+#define HLL_REGISTERS   (1 << HLL_BITS)     /* Standard error 1.04 / sqrt(4096) ~= 1.6% */
+#define CMS_DEPTH       4
+#define CMS_WIDTH       8192
+#define TOP_CANDIDATES  64
+#define TOP_REPORT      10
+
+/*
+** Sketches of a single gram size
+*/
+struct GramProfile {
+    sqlite3_int64 postings;
+    uint8_t aHll[HLL_REGISTERS];
+    uint32_t aCms[CMS_DEPTH][CMS_WIDTH];
+    std::unordered_map<std::string, uint32_t> top;  /* Heavy hitter candidates and their estimates */
+    uint32_t topMin;                                /* Smallest estimate in top once full */
+
+    GramProfile() : postings(0), topMin(0) {
+        (void) memset(aHll, 0, sizeof(aHll));
+        (void) memset(aCms, 0, sizeof(aCms));
+    }
+};
+
+struct ProfileState {
+    ngram_context_t opts;
+    sqlite3_int64 rows;
+    sqlite3_int64 bytes;
+    GramProfile aProfile[MAX_GRAM];
+};
+
+static uint64_t profile_hash(const char *p, int n) {
+    // 64-bit FNV-1a followed by the splitmix64 finalizer, HyperLogLog needs well mixed high bits
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < n; i++) {
+        h ^= (unsigned char) p[i];
+        h *= 1099511628211ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+static void profile_top(GramProfile *p, const char *pToken, int nToken, uint32_t estimate) {
+    std::string gram(pToken, nToken);
+    auto it = p->top.find(gram);
+    if (it != p->top.end()) {
+        it->second = estimate;
+        return;
+    }
+    if (p->top.size() >= TOP_CANDIDATES) {
+        if (estimate <= p->topMin) return;
+        auto victim = std::min_element(p->top.begin(), p->top.end(),
+                                       [](const std::pair<const std::string, uint32_t> &a,
+                                          const std::pair<const std::string, uint32_t> &b) {
+                                           return a.second < b.second;
+                                       });
+        p->top.erase(victim);
+    }
+    p->top.emplace(std::move(gram), estimate);
+    if (p->top.size() >= TOP_CANDIDATES) {
+        p->topMin = UINT32_MAX;
+        for (const auto &e: p->top) p->topMin = std::min(p->topMin, e.second);
+    }
+}
+
+static int profile_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+    UNUSED(tflags, iStart);
+    UNUSED(iEnd);
+    auto p = (GramProfile *) pCtx;
+    p->postings++;
+
+    uint64_t h = profile_hash(pToken, nToken);
+
+    // HyperLogLog: low bits pick the register, rank of the remaining bits
+    uint32_t reg = (uint32_t) (h & (HLL_REGISTERS - 1));
+    uint64_t w = h >> HLL_BITS;
+    auto rank = (uint8_t) (w == 0 ? 64 - HLL_BITS + 1 : __builtin_ctzll(w) + 1);
+    if (rank > p->aHll[reg]) p->aHll[reg] = rank;
+
+    // Count-min sketch with conservative update, rows indexed by double hashing
+    auto h1 = (uint32_t) h;
+    auto h2 = (uint32_t) (h >> 32) | 1u;
+    uint32_t *aCell[CMS_DEPTH];
+    uint32_t estimate = UINT32_MAX;
+    for (int i = 0; i < CMS_DEPTH; i++) {
+        aCell[i] = &p->aCms[i][(h1 + (uint32_t) i * h2) % CMS_WIDTH];
+        estimate = std::min(estimate, *aCell[i]);
+    }
+    if (estimate != UINT32_MAX) estimate++;
+    for (auto cell: aCell) {
+        if (*cell < estimate) *cell = estimate;
+    }
+
+    profile_top(p, pToken, nToken, estimate);
+    return SQLITE_OK;
+}
+
+static double hll_estimate(const uint8_t *aHll) {
+    const double m = HLL_REGISTERS;
+    double sum = 0.0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -aHll[i]);
+        if (aHll[i] == 0) zeros++;
+    }
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    // Small range correction: linear counting
+    if (estimate <= 2.5 * m && zeros != 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+static void json_string(std::string &out, const std::string &s) {
+    out += '"';
+    for (unsigned char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char) c;
+        } else if (c < 0x20) {
+            char buf[8];
+            (void) snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char) c;
+        }
+    }
+    out += '"';
+}
+
+static void ngram_profile_step(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    auto pp = (ProfileState **) sqlite3_aggregate_context(pCtx, sizeof(ProfileState *));
+    if (pp == nullptr) {
+        sqlite3_result_error_nomem(pCtx);
+        return;
+    }
+
+    if (*pp == nullptr) {
+        auto p = new(std::nothrow) ProfileState();
+        if (p == nullptr) {
+            sqlite3_result_error_nomem(pCtx);
+            return;
+        }
+
+        const char *dict_path = nullptr;
+        bool ok = true;
+        (void) memset(&p->opts, 0, sizeof(p->opts));
+        if (nVal > 1 && sqlite3_value_text(apVal[1]) != nullptr) {
+            std::vector<std::string> words;
+            for (const auto &w: ngram_tokenizer::split((const char *) sqlite3_value_text(apVal[1]), ' ')) {
+                if (!w.empty()) words.push_back(w);
+            }
+            std::vector<const char *> azArg;
+            for (const auto &w: words) azArg.push_back(w.c_str());
+            azArg.push_back(nullptr);
+            ok = ngram_tokenizer::parse_options(azArg.data(), (int) azArg.size() - 1, &p->opts, &dict_path);
+        }
+        if (!ok || dict_path != nullptr || p->opts.json != NGRAM_JSON_OFF) {
+            delete p;
+            sqlite3_result_error(pCtx, "invalid options to function " LIBNAME "_profile()", -1);
+            return;
+        }
+        *pp = p;
+    }
+
+    ProfileState *p = *pp;
+    auto zText = (const char *) sqlite3_value_text(apVal[0]);
+    int nText = sqlite3_value_bytes(apVal[0]);
+    if (zText == nullptr) {
+        return;
+    }
+    p->rows++;
+    p->bytes += nText;
+
+    ngram_context_t opts = p->opts;
+    for (int n = MIN_GRAM; n <= MAX_GRAM; n++) {
+        opts.ngram = n;
+        ngram_tokenizer::GramStream gs(zText, nText, &opts, opts.max_tokens);
+        int rc = gs.run(&p->aProfile[n - 1], profile_cb);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error_code(pCtx, rc);
+            return;
+        }
+    }
+}
+
+/*
+** Return the profile as a JSON object
+*/
+static void ngram_profile_final(sqlite3_context *pCtx) {
+    auto pp = (ProfileState **) sqlite3_aggregate_context(pCtx, 0);
+    if (pp == nullptr || *pp == nullptr) {
+        return;
+    }
+    ProfileState *p = *pp;
+
+    std::string json = "{\"rows\":" + std::to_string(p->rows) + ",\"bytes\":" + std::to_string(p->bytes) + ",\"grams\":[";
+    for (int n = MIN_GRAM; n <= MAX_GRAM; n++) {
+        GramProfile &prof = p->aProfile[n - 1];
+        std::vector<std::pair<std::string, uint32_t>> top(prof.top.begin(), prof.top.end());
+        std::sort(top.begin(), top.end(), [](const std::pair<std::string, uint32_t> &a,
+                                             const std::pair<std::string, uint32_t> &b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (top.size() > TOP_REPORT) top.resize(TOP_REPORT);
+
+        if (n != MIN_GRAM) json += ',';
+        json += "{\"n\":" + std::to_string(n);
+        json += ",\"distinct\":" + std::to_string(prof.postings == 0 ? 0 : llround(hll_estimate(prof.aHll)));
+        json += ",\"postings\":" + std::to_string(prof.postings);
+        json += ",\"top\":[";
+        for (size_t i = 0; i < top.size(); i++) {
+            if (i != 0) json += ',';
+            json += '[';
+            json_string(json, top[i].first);
+            json += ',' + std::to_string(top[i].second) + ']';
+        }
+        json += "]}";
+    }
+    json += "]}";
+
+    delete p;
+    *pp = nullptr;
+    sqlite3_result_text(pCtx, json.c_str(), (int) json.size(), SQLITE_TRANSIENT);
+}
+
+int ngram_profile_init(sqlite3 *db) {
+    int rc = sqlite3_create_function(db, LIBNAME "_profile", 1, SQLITE_UTF8, nullptr,
+                                     nullptr, ngram_profile_step, ngram_profile_final);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_profile", 2, SQLITE_UTF8, nullptr,
+                                     nullptr, ngram_profile_step, ngram_profile_final);
+    }
+    return rc;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+int ngram_profile_init(sqlite3 *);
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <glog/logging.h>
+#include <new>
+#include <vector>
+
+#include "rank.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// N-gram aware ranking function
+//
+// bm25() counts every overlapping gram as a term occurrence, thus long CJK runs and the extra prefix grams
+//  emitted for 'Hello世界' inflate both term frequencies and document lengths.
+//  ngram_rank() scores each phrase once by how much of the query it covers instead:
+//
+//  coverage    = sum(w[p] for matched p) / sum(w[p])       w[p] = idf(p) * xPhraseSize(p)
+//  frequency   = sum(w[p] * log(1 + log(tf[p])) for matched p) / sum(w[p])
+//  proximity   = query tokens covered by the tightest window holding the most distinct phrases / window size
+//  score       = coverage * (1 + frequency) * (1 + proximity) / (1 - b + b * dl / avgdl)
+//
+// Like bm25(), the negated score is returned so that "ORDER BY rank" yields the best matches first.
+//
+// see:
+//  https://github.com/sqlite/sqlite/blob/master/ext/fts5/fts5_aux.c
+
+#define RANK_B  0.25    /* Document length normalization strength */
+
+/*
+** Per-query statistics, computed once on the first row and cached by xSetAuxdata()
+*/
+typedef struct {
+    int col;    /* Column */
+    int off;    /* Token offset */
+    int phrase; /* Phrase index */
+} RankInst;
+
+struct RankData {
+    int nPhrase;
+    std::vector<double> aWeight;    /* idf(p) * xPhraseSize(p) */
+    std::vector<int> aSize;         /* xPhraseSize(p) */
+    double totalWeight;
+    double avgdl;                   /* Average tokens per row, all columns */
+
+    /* Per-row scratch buffers, reused across rows */
+    std::vector<int> aTf;
+    std::vector<int> aCnt;
+    std::vector<RankInst> aInst;
+};
+
+static void rankDataDelete(void *p) {
+    delete (RankData *) p;
+}
+
+/*
+** xQueryPhrase() callback counting rows which contain a phrase
+*/
+static int rankCountCb(const Fts5ExtensionApi *pApi, Fts5Context *pFts, void *pUserData) {
+    UNUSED(pApi, pFts);
+    (*(sqlite3_int64 *) pUserData)++;
+    return SQLITE_OK;
+}
+
+static int rankGetData(const Fts5ExtensionApi *pApi, Fts5Context *pFts, RankData **ppData) {
+    auto p = (RankData *) pApi->xGetAuxdata(pFts, 0);
+    if (p != nullptr) {
+        *ppData = p;
+        return SQLITE_OK;
+    }
+
+    p = new(std::nothrow) RankData();
+    if (p == nullptr) return SQLITE_NOMEM;
+
+    sqlite3_int64 nRow = 0;
+    sqlite3_int64 nToken = 0;
+    int rc = pApi->xRowCount(pFts, &nRow);
+    if (rc == SQLITE_OK) {
+        rc = pApi->xColumnTotalSize(pFts, -1, &nToken);
+    }
+
+    p->nPhrase = pApi->xPhraseCount(pFts);
+    p->totalWeight = 0;
+    p->avgdl = nRow > 0 ? (double) nToken / (double) nRow : 1.0;
+    if (p->avgdl <= 0) p->avgdl = 1.0;
+    p->aWeight.resize(p->nPhrase);
+    p->aSize.resize(p->nPhrase);
+    p->aTf.resize(p->nPhrase);
+    p->aCnt.resize(p->nPhrase);
+
+    for (int i = 0; rc == SQLITE_OK && i < p->nPhrase; i++) {
+        sqlite3_int64 nHit = 0;
+        rc = pApi->xQueryPhrase(pFts, i, (void *) &nHit, rankCountCb);
+        if (rc == SQLITE_OK) {
+            // Smoothed idf, stays positive for phrases matching over half of the rows
+            //  so that common phrases still count towards coverage
+            double idf = log(1.0 + ((double) nRow - (double) nHit + 0.5) / ((double) nHit + 0.5));
+            p->aSize[i] = pApi->xPhraseSize(pFts, i);
+            p->aWeight[i] = idf * (p->aSize[i] > 0 ? p->aSize[i] : 1);
+            p->totalWeight += p->aWeight[i];
+            DLOG(INFO) << "phrase " << i << " nHit: " << nHit << " idf: " << idf << " size: " << p->aSize[i];
+        }
+    }
+
+    if (rc == SQLITE_OK) {
+        rc = pApi->xSetAuxdata(pFts, p, rankDataDelete);
+        // xSetAuxdata() invokes the destructor itself on failure
+    } else {
+        delete p;
+    }
+    if (rc == SQLITE_OK) {
+        *ppData = p;
+    }
+    return rc;
+}
+
+/*
+** Find the tightest window in aInst[lo, hi)(a single column) holding the most distinct phrases
+*/
+static void rankWindow(RankData *p, size_t lo, size_t hi, int *pnDistinct, double *pProximity) {
+    int nDistinct = 0;
+    for (size_t i = lo; i < hi; i++) {
+        if (p->aCnt[p->aInst[i].phrase]++ == 0) nDistinct++;
+    }
+    for (size_t i = lo; i < hi; i++) p->aCnt[p->aInst[i].phrase] = 0;
+
+    double best = 0.0;
+    int nIn = 0;
+    int covered = 0;    /* Tokens of distinct phrases inside the window */
+    size_t l = lo;
+    for (size_t r = lo; r < hi; r++) {
+        const RankInst &ri = p->aInst[r];
+        if (p->aCnt[ri.phrase]++ == 0) {
+            nIn++;
+            covered += p->aSize[ri.phrase];
+        }
+
+        while (nIn == nDistinct) {
+            const RankInst &li = p->aInst[l];
+            int span = ri.off + p->aSize[ri.phrase] - li.off;
+            if (span > 0) {
+                double proximity = (double) covered / span;
+                if (proximity > best) best = proximity;
+            }
+            if (--p->aCnt[li.phrase] == 0) {
+                nIn--;
+                covered -= p->aSize[li.phrase];
+            }
+            l++;
+        }
+    }
+    for (size_t i = l; i < hi; i++) p->aCnt[p->aInst[i].phrase] = 0;
+
+    if (nDistinct > *pnDistinct || (nDistinct == *pnDistinct && best > *pProximity)) {
+        *pnDistinct = nDistinct;
+        *pProximity = best > 1.0 ? 1.0 : best;
+    }
+}
+
+void ngram_rank(
+        const Fts5ExtensionApi *pApi,   /* API offered by current FTS version */
+        Fts5Context *pFts,              /* First arg to pass to pApi functions */
+        sqlite3_context *pCtx,          /* Context for returning result/error */
+        int nVal,                       /* Number of values in apVal[] array */
+        sqlite3_value **apVal           /* Array of trailing arguments */
+) {
+    UNUSED(apVal);
+    if (nVal != 0) {
+        sqlite3_result_error(pCtx, "wrong number of arguments to function " LIBNAME "_rank()", -1);
+        return;
+    }
+
+    RankData *p = nullptr;
+    int rc = rankGetData(pApi, pFts, &p);
+
+    int nInst = 0;
+    int dl = 0;     /* Tokens in the current row, all columns */
+    if (rc == SQLITE_OK) {
+        rc = pApi->xInstCount(pFts, &nInst);
+    }
+    if (rc == SQLITE_OK) {
+        rc = pApi->xColumnSize(pFts, -1, &dl);
+    }
+
+    if (rc == SQLITE_OK) {
+        std::fill(p->aTf.begin(), p->aTf.end(), 0);
+        p->aInst.clear();
+
+        // Instances come sorted by column and token offset
+        for (int i = 0; rc == SQLITE_OK && i < nInst; i++) {
+            RankInst ri{};
+            rc = pApi->xInst(pFts, i, &ri.phrase, &ri.col, &ri.off);
+            if (rc == SQLITE_OK) {
+                p->aTf[ri.phrase]++;
+                p->aInst.push_back(ri);
+            }
+        }
+    }
+
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(pCtx, rc);
+        return;
+    }
+
+    double coverage = 0.0;
+    double frequency = 0.0;
+    for (int i = 0; i < p->nPhrase; i++) {
+        if (p->aTf[i] > 0) {
+            coverage += p->aWeight[i];
+            frequency += p->aWeight[i] * log1p(log((double) p->aTf[i]));
+        }
+    }
+    if (p->totalWeight > 0) {
+        coverage /= p->totalWeight;
+        frequency /= p->totalWeight;
+    }
+
+    double proximity = 0.0;
+    if (p->nPhrase == 1) {
+        proximity = 1.0;
+    } else {
+        int nDistinct = 0;
+        size_t lo = 0;
+        for (size_t i = 1; i <= p->aInst.size(); i++) {
+            if (i == p->aInst.size() || p->aInst[i].col != p->aInst[lo].col) {
+                rankWindow(p, lo, i, &nDistinct, &proximity);
+                lo = i;
+            }
+        }
+        if (nDistinct > 0) {
+            proximity *= (double) (nDistinct - 1) / (p->nPhrase - 1);
+        }
+    }
+
+    double norm = 1.0 - RANK_B + RANK_B * (double) dl / p->avgdl;
+    double score = coverage * (1.0 + frequency) * (1.0 + proximity) / norm;
+    DLOG(INFO) << "coverage: " << coverage << " frequency: " << frequency
+               << " proximity: " << proximity << " dl: " << dl << " score: " << score;
+
+    sqlite3_result_double(pCtx, -1.0 * score);
+}
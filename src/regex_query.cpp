@@ -0,0 +1,1026 @@
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "regex_query.h"
+#include "grapheme.h"
+#include "like.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// Regular expression prefilter
+//
+//  SELECT * FROM t1 WHERE t1 MATCH ngram_regex_query('linux (kernel|内核)', 2) AND ngram_regexp('linux (kernel|内核)', x);
+//
+// The regex is parsed into a boolean expression of literal strings every match must contain,
+//  the literals are then decomposed into terms by the LIKE acceleration rules(see like.cpp).
+//
+// see:
+//  https://swtch.com/~rsc/regexp/regexp4.html
+//  https://github.com/google/codesearch/blob/master/index/regexp.go
+
+#define MAX_EXACT   16      /* Max exact set size before it's folded into the match query */
+#define MAX_DEPTH   256     /* Max group nesting depth */
+#define MAX_PROGRAM 65536   /* Max NFA instructions, counted repetitions are expanded */
+
+namespace ngram_tokenizer {
+    struct Query {
+        typedef enum {
+            ANY,        /* Matches everything */
+            LITERAL,
+            AND,
+            OR,
+        } op_t;
+
+        op_t op;
+        std::string literal;
+        std::vector<Query> subs;
+
+        Query() : op(ANY) {}
+
+        explicit Query(const std::string &s) : op(LITERAL), literal(s) {}
+    };
+
+    static Query query_combine(Query::op_t op, Query a, Query b) {
+        if (a.op == Query::ANY) return op == Query::AND ? b : a;
+        if (b.op == Query::ANY) return op == Query::AND ? a : b;
+
+        Query q;
+        q.op = op;
+        for (auto *x: {&a, &b}) {
+            if (x->op == op) {
+                for (auto &sub: x->subs) q.subs.emplace_back(std::move(sub));
+            } else {
+                q.subs.emplace_back(std::move(*x));
+            }
+        }
+        return q;
+    }
+
+    /*
+    ** Regex analysis result, see regexp4.html
+    */
+    struct RegexInfo {
+        bool emptyable;
+        bool exact_valid;               /* Whether exact holds every string the regex may match */
+        std::set<std::string> exact;
+        Query match;                    /* Condition every matched string satisfies */
+
+        static RegexInfo empty() {
+            RegexInfo info;
+            info.emptyable = true;
+            info.exact_valid = true;
+            info.exact.insert("");
+            return info;
+        }
+
+        static RegexInfo any_char() {
+            RegexInfo info;
+            info.emptyable = false;
+            info.exact_valid = false;
+            return info;
+        }
+
+        static RegexInfo literal(const std::set<std::string> &chars) {
+            RegexInfo info;
+            info.emptyable = false;
+            info.exact_valid = true;
+            info.exact = chars;
+            return info;
+        }
+
+        Query to_match() const {
+            if (!exact_valid) return match;
+            Query q;
+            bool first = true;
+            for (const auto &s: exact) {
+                if (s.empty()) return match;
+                q = first ? Query(s) : query_combine(Query::OR, q, Query(s));
+                first = false;
+            }
+            return query_combine(Query::AND, match, q);
+        }
+
+        void make_inexact() {
+            match = to_match();
+            exact_valid = false;
+            exact.clear();
+        }
+    };
+
+    static RegexInfo regex_concat(RegexInfo x, RegexInfo y) {
+        RegexInfo info;
+        info.emptyable = x.emptyable && y.emptyable;
+        if (x.exact_valid && y.exact_valid && x.exact.size() * y.exact.size() <= MAX_EXACT) {
+            info.exact_valid = true;
+            for (const auto &a: x.exact) {
+                for (const auto &b: y.exact) {
+                    info.exact.insert(a + b);
+                }
+            }
+            info.match = query_combine(Query::AND, x.match, y.match);
+        } else {
+            info.exact_valid = false;
+            info.match = query_combine(Query::AND, x.to_match(), y.to_match());
+        }
+        return info;
+    }
+
+    static RegexInfo regex_alternate(RegexInfo x, RegexInfo y) {
+        RegexInfo info;
+        info.emptyable = x.emptyable || y.emptyable;
+        if (x.exact_valid && y.exact_valid && x.exact.size() + y.exact.size() <= MAX_EXACT) {
+            info.exact_valid = true;
+            info.exact = x.exact;
+            info.exact.insert(y.exact.begin(), y.exact.end());
+            info.match = query_combine(Query::OR, x.match, y.match);
+        } else {
+            info.exact_valid = false;
+            info.match = query_combine(Query::OR, x.to_match(), y.to_match());
+        }
+        return info;
+    }
+
+    // x{min,}, repetition counts above one add nothing to the required literals
+    static RegexInfo regex_repeat(RegexInfo x, int min) {
+        if (min == 0) {
+            RegexInfo info = RegexInfo::empty();
+            info.exact_valid = false;
+            info.exact.clear();
+            return info;
+        }
+        x.make_inexact();
+        return x;
+    }
+
+    static RegexInfo regex_optional(RegexInfo x) {
+        if (x.exact_valid && x.exact.size() + 1 <= MAX_EXACT) {
+            x.exact.insert("");
+            x.match = Query();
+            x.emptyable = true;
+            return x;
+        }
+        return regex_repeat(x, 0);
+    }
+
+    // Any string including the empty one, e.g. a back-reference
+    static RegexInfo regex_any_string() {
+        RegexInfo info = RegexInfo::empty();
+        info.exact_valid = false;
+        info.exact.clear();
+        return info;
+    }
+
+    /*
+    ** Parsed regex, shared by the prefilter analysis and the NFA compiler
+    */
+    struct RegexNode {
+        typedef enum {
+            EMPTY,
+            CHARS,      /* One character in ranges(or not in ranges if negate) */
+            CONCAT,
+            ALTERNATE,
+            REPEAT,
+            ASSERT,
+            BACKREF,
+            LOOKAROUND,
+        } type_t;
+
+        typedef enum {
+            BEGIN,
+            END,
+            WORD_BOUNDARY,
+            NOT_WORD_BOUNDARY,
+        } assert_t;
+
+        type_t type;
+        std::vector<std::pair<unsigned int, unsigned int>> ranges;  /* Inclusive code point ranges */
+        bool negate;
+        std::set<std::string> exact;    /* Characters of CHARS if known and few, otherwise empty */
+        int min;                        /* REPEAT */
+        int max;                        /* REPEAT, -1 means unbounded */
+        assert_t assertion;
+        std::vector<RegexNode> subs;
+
+        explicit RegexNode(type_t type = EMPTY) : type(type), negate(false), min(0), max(0), assertion(BEGIN) {}
+
+        static RegexNode chars(unsigned int lo, unsigned int hi) {
+            RegexNode node(CHARS);
+            node.ranges.emplace_back(lo, hi);
+            return node;
+        }
+    };
+
+    typedef std::vector<std::pair<unsigned int, unsigned int>> ranges_t;
+
+    static const ranges_t DIGIT_RANGES = {{'0', '9'}};
+    static const ranges_t WORD_RANGES = {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}};
+    static const ranges_t SPACE_RANGES = {{'\t', '\r'}, {' ', ' '}, {0xA0, 0xA0}, {0x1680, 0x1680},
+                                          {0x2000, 0x200A}, {0x2028, 0x2029}, {0x202F, 0x202F},
+                                          {0x205F, 0x205F}, {0x3000, 0x3000}, {0xFEFF, 0xFEFF}};
+    static const ranges_t LINE_TERMINATOR_RANGES = {{'\n', '\n'}, {'\r', '\r'}, {0x2028, 0x2029}};
+
+    // Complement of sorted disjoint ranges over all code points
+    static ranges_t ranges_complement(const ranges_t &ranges) {
+        ranges_t out;
+        unsigned int lo = 0;
+        for (const auto &r: ranges) {
+            if (r.first > lo) out.emplace_back(lo, r.first - 1);
+            lo = r.second + 1;
+        }
+        if (lo <= 0x10FFFF) out.emplace_back(lo, 0x10FFFF);
+        return out;
+    }
+
+    /*
+    ** Recursive descent parser of the ECMAScript regex syntax
+    */
+    class RegexParser {
+    public:
+        RegexParser(const char *z, int n) : z(z), n(n), i(0), depth(0), ok(true) {}
+
+        bool parse(RegexNode &node) {
+            node = parse_alternate();
+            return ok && i == n;
+        }
+
+    private:
+        bool at_end() const {
+            return i >= n;
+        }
+
+        unsigned int next_char(std::string *s) {
+            unsigned int cp;
+            int len = utf8_decode(z + i, n - i, &cp);
+            if (len <= 0) {
+                cp = (unsigned char) z[i];
+                len = 1;
+            }
+            if (s != nullptr) s->assign(z + i, len);
+            i += len;
+            return cp;
+        }
+
+        RegexNode literal() {
+            std::string s;
+            unsigned int cp = next_char(&s);
+            RegexNode node = RegexNode::chars(cp, cp);
+            node.exact.insert(s);
+            return node;
+        }
+
+        RegexNode parse_alternate() {
+            RegexNode x = parse_concat();
+            if (ok && !at_end() && z[i] == '|') {
+                RegexNode alt(RegexNode::ALTERNATE);
+                alt.subs.emplace_back(std::move(x));
+                while (ok && !at_end() && z[i] == '|') {
+                    i++;
+                    alt.subs.emplace_back(parse_concat());
+                }
+                return alt;
+            }
+            return x;
+        }
+
+        RegexNode parse_concat() {
+            RegexNode x(RegexNode::CONCAT);
+            while (ok && !at_end() && z[i] != '|' && z[i] != ')') {
+                x.subs.emplace_back(parse_repeat());
+            }
+            return x;
+        }
+
+        bool parse_number(int *val) {
+            int start = i;
+            long v = 0;
+            while (!at_end() && z[i] >= '0' && z[i] <= '9' && v < 100000) {
+                v = v * 10 + (z[i++] - '0');
+            }
+            *val = (int) v;
+            return i > start;
+        }
+
+        RegexNode parse_repeat() {
+            RegexNode x = parse_atom();
+            if (!ok || at_end()) {
+                return x;
+            }
+
+            int min;
+            int max;
+            char c = z[i];
+            if (c == '*' || c == '+' || c == '?') {
+                i++;
+                min = c == '+' ? 1 : 0;
+                max = c == '?' ? 1 : -1;
+            } else if (c == '{') {
+                int save = i++;
+                if (!parse_number(&min)) {
+                    // Not a quantifier, ECMAScript treats '{' as a literal then
+                    i = save;
+                    return x;
+                }
+                max = min;
+                if (!at_end() && z[i] == ',') {
+                    i++;
+                    if (!parse_number(&max)) max = -1;
+                }
+                if (at_end() || z[i] != '}' || (max != -1 && max < min)) {
+                    ok = false;
+                    return x;
+                }
+                i++;
+            } else {
+                return x;
+            }
+            // Lazy quantifier
+            if (!at_end() && z[i] == '?') i++;
+            // Nothing to repeat
+            if (!at_end() && (z[i] == '*' || z[i] == '+' || z[i] == '?')) {
+                ok = false;
+            }
+
+            RegexNode r(RegexNode::REPEAT);
+            r.min = min;
+            r.max = max;
+            r.subs.emplace_back(std::move(x));
+            return r;
+        }
+
+        // Parse hex digits after \x or \u, return false if there aren't enough
+        bool parse_hex(int digits, unsigned int *cp) {
+            if (n - i < digits) return false;
+            unsigned int v = 0;
+            for (int k = 0; k < digits; k++) {
+                if (!isxdigit((unsigned char) z[i + k])) return false;
+                v = v * 16 + (unsigned int) (isdigit((unsigned char) z[i + k]) ? z[i + k] - '0' : (z[i + k] | 0x20) - 'a' + 10);
+            }
+            i += digits;
+            *cp = v;
+            return true;
+        }
+
+        /*
+        ** Parse an escape sequence after '\' into a CHARS node,
+        **  or an ASSERT/BACKREF node outside of a character class.
+        */
+        RegexNode parse_escape(bool in_class) {
+            if (at_end()) {
+                ok = false;
+                return RegexNode();
+            }
+
+            RegexNode node(RegexNode::CHARS);
+            unsigned int cp;
+            char c = z[i];
+            switch (c) {
+                case 'd':
+                case 'D':
+                case 'w':
+                case 'W':
+                case 's':
+                case 'S': {
+                    i++;
+                    const ranges_t &ranges = (c | 0x20) == 'd' ? DIGIT_RANGES : (c | 0x20) == 'w' ? WORD_RANGES : SPACE_RANGES;
+                    node.ranges = (c & 0x20) ? ranges : ranges_complement(ranges);
+                    return node;
+                }
+                case 'b':
+                case 'B':
+                    i++;
+                    if (in_class) {
+                        // Backspace in a character class
+                        return RegexNode::chars(c == 'b' ? '\b' : 'B', c == 'b' ? '\b' : 'B');
+                    }
+                    node.type = RegexNode::ASSERT;
+                    node.assertion = c == 'b' ? RegexNode::WORD_BOUNDARY : RegexNode::NOT_WORD_BOUNDARY;
+                    return node;
+                case 'n':
+                case 't':
+                case 'r':
+                    i++;
+                    cp = c == 'n' ? '\n' : c == 't' ? '\t' : '\r';
+                    node = RegexNode::chars(cp, cp);
+                    node.exact.insert(std::string(1, (char) cp));
+                    return node;
+                case 'f':
+                case 'v':
+                    // Rarely used in searches, thus no exact character for the prefilter
+                    i++;
+                    cp = c == 'f' ? '\f' : '\v';
+                    return RegexNode::chars(cp, cp);
+                case 'x':
+                case 'u':
+                    i++;
+                    if (!parse_hex(c == 'x' ? 2 : 4, &cp)) cp = (unsigned char) c;
+                    return RegexNode::chars(cp, cp);
+                case 'c':
+                    i++;
+                    if (!at_end() && isalpha((unsigned char) z[i])) {
+                        cp = (unsigned int) z[i++] % 32;
+                        return RegexNode::chars(cp, cp);
+                    }
+                    i--;    // "\c" is a literal backslash followed by 'c'
+                    return RegexNode::chars('\\', '\\');
+                case '0':
+                    i++;
+                    return RegexNode::chars(0, 0);
+                case 'k':
+                    if (!in_class && i + 1 < n && z[i + 1] == '<') {
+                        // Named back-reference
+                        while (!at_end() && z[i] != '>') i++;
+                        if (at_end()) {
+                            ok = false;
+                            return RegexNode();
+                        }
+                        i++;
+                        return RegexNode(RegexNode::BACKREF);
+                    }
+                    return literal();
+                default:
+                    if (!in_class && c >= '1' && c <= '9') {
+                        while (!at_end() && isdigit((unsigned char) z[i])) i++;
+                        return RegexNode(RegexNode::BACKREF);
+                    }
+                    return literal();
+            }
+        }
+
+        // Parse one class atom into node, return false if it's not a single character
+        bool parse_class_atom(RegexNode &node) {
+            if (z[i] == '\\') {
+                i++;
+                node = parse_escape(true);
+            } else {
+                node = literal();
+            }
+            return node.ranges.size() == 1 && node.ranges[0].first == node.ranges[0].second;
+        }
+
+        RegexNode parse_class() {
+            RegexNode cls(RegexNode::CHARS);
+            std::set<std::string> chars;
+            bool exact = true;
+
+            if (!at_end() && z[i] == '^') {
+                i++;
+                cls.negate = true;
+                exact = false;
+            }
+            while (ok && !at_end() && z[i] != ']') {
+                RegexNode lo;
+                bool single = parse_class_atom(lo);
+                if (single && i + 1 < n && z[i] == '-' && z[i + 1] != ']') {
+                    // Range
+                    i++;
+                    RegexNode hi;
+                    if (parse_class_atom(hi) && lo.ranges[0].first <= hi.ranges[0].first) {
+                        cls.ranges.emplace_back(lo.ranges[0].first, hi.ranges[0].first);
+                    } else if (hi.ranges.size() == 1 && hi.ranges[0].first == hi.ranges[0].second) {
+                        ok = false;     // Out of order range
+                    } else {
+                        // Class escape as a range end, '-' is a literal then
+                        cls.ranges.insert(cls.ranges.end(), lo.ranges.begin(), lo.ranges.end());
+                        cls.ranges.emplace_back('-', '-');
+                        cls.ranges.insert(cls.ranges.end(), hi.ranges.begin(), hi.ranges.end());
+                    }
+                    exact = false;
+                    continue;
+                }
+                cls.ranges.insert(cls.ranges.end(), lo.ranges.begin(), lo.ranges.end());
+                if (lo.exact.empty()) {
+                    exact = false;
+                } else {
+                    chars.insert(lo.exact.begin(), lo.exact.end());
+                }
+            }
+            if (at_end()) {
+                ok = false;
+                return cls;
+            }
+            i++;    // ']'
+
+            if (exact && !chars.empty() && chars.size() <= 4) {
+                cls.exact = chars;
+            }
+            return cls;
+        }
+
+        RegexNode parse_atom() {
+            char c = z[i];
+            switch (c) {
+                case '(': {
+                    i++;
+                    RegexNode::type_t type = RegexNode::CONCAT;
+                    if (i < n && z[i] == '?') {
+                        if (i + 1 < n && (z[i + 1] == '=' || z[i + 1] == '!')) {
+                            type = RegexNode::LOOKAROUND;
+                            i += 2;
+                        } else if (i + 2 < n && z[i + 1] == '<' && (z[i + 2] == '=' || z[i + 2] == '!')) {
+                            type = RegexNode::LOOKAROUND;
+                            i += 3;
+                        } else if (i + 1 < n && z[i + 1] == ':') {
+                            i += 2;
+                        } else {
+                            ok = false;
+                            return RegexNode();
+                        }
+                    }
+                    if (++depth > MAX_DEPTH) {
+                        ok = false;
+                        return RegexNode();
+                    }
+                    RegexNode x = parse_alternate();
+                    depth--;
+                    if (at_end() || z[i] != ')') {
+                        ok = false;
+                        return x;
+                    }
+                    i++;
+                    if (type == RegexNode::LOOKAROUND) {
+                        RegexNode la(RegexNode::LOOKAROUND);
+                        la.subs.emplace_back(std::move(x));
+                        return la;
+                    }
+                    return x;
+                }
+                case '.': {
+                    i++;
+                    RegexNode node(RegexNode::CHARS);
+                    node.ranges = LINE_TERMINATOR_RANGES;
+                    node.negate = true;
+                    return node;
+                }
+                case '[':
+                    i++;
+                    return parse_class();
+                case '^':
+                case '$': {
+                    i++;
+                    RegexNode node(RegexNode::ASSERT);
+                    node.assertion = c == '^' ? RegexNode::BEGIN : RegexNode::END;
+                    return node;
+                }
+                case '*':
+                case '+':
+                case '?':
+                    ok = false;
+                    i++;
+                    return RegexNode();
+                case '\\':
+                    i++;
+                    return parse_escape(false);
+                default:
+                    return literal();
+            }
+        }
+
+        const char *z;
+        int n;
+        int i;
+        int depth;
+        bool ok;
+    };
+
+    static RegexInfo regex_analyze(const RegexNode &node) {
+        switch (node.type) {
+            case RegexNode::CHARS:
+                return node.exact.empty() ? RegexInfo::any_char() : RegexInfo::literal(node.exact);
+            case RegexNode::CONCAT: {
+                RegexInfo x = RegexInfo::empty();
+                for (const auto &sub: node.subs) {
+                    x = regex_concat(x, regex_analyze(sub));
+                }
+                return x;
+            }
+            case RegexNode::ALTERNATE: {
+                RegexInfo x = regex_analyze(node.subs[0]);
+                for (size_t k = 1; k < node.subs.size(); k++) {
+                    x = regex_alternate(x, regex_analyze(node.subs[k]));
+                }
+                return x;
+            }
+            case RegexNode::REPEAT: {
+                RegexInfo x = regex_analyze(node.subs[0]);
+                return node.min == 0 && node.max == 1 ? regex_optional(x) : regex_repeat(x, node.min);
+            }
+            case RegexNode::BACKREF:
+                // Repeats a captured string, which may be anything
+                return regex_any_string();
+            default:
+                // Assertions and lookarounds consume nothing
+                return RegexInfo::empty();
+        }
+    }
+
+    /*
+    ** Thompson NFA of a parsed regex, simulated in O(pattern * text) time without backtracking
+    **
+    ** see: https://swtch.com/~rsc/regexp/regexp1.html
+    */
+    class RegexProgram {
+    public:
+        // Compile node, return an error message or nullptr
+        const char *compile(const RegexNode &node) {
+            insts.clear();
+            classes.clear();
+            error = nullptr;
+            emit(node);
+            push({MATCH, 0, 0});
+            return error;
+        }
+
+        bool search(const char *z, int n) const {
+            std::vector<int> mark(insts.size(), -1);
+            std::vector<int> stack;
+            std::vector<int> curr;
+            std::vector<int> next;
+            int prev = -1;
+
+            for (int i = 0, step = 0;; step++) {
+                int cur = -1;
+                int len = 0;
+                if (i < n) {
+                    unsigned int cp;
+                    len = utf8_decode(z + i, n - i, &cp);
+                    if (len <= 0) {
+                        cp = (unsigned char) z[i];
+                        len = 1;
+                    }
+                    cur = (int) cp;
+                }
+
+                // Epsilon closure of the threads after the previous character, plus a new thread starting here
+                curr.clear();
+                next.push_back(0);
+                for (int pc: next) {
+                    stack.push_back(pc);
+                    while (!stack.empty()) {
+                        int k = stack.back();
+                        stack.pop_back();
+                        if (mark[k] == step) continue;
+                        mark[k] = step;
+                        const Inst &inst = insts[k];
+                        switch (inst.op) {
+                            case MATCH:
+                                return true;
+                            case CHARS:
+                                curr.push_back(k);
+                                break;
+                            case JMP:
+                                stack.push_back(inst.x);
+                                break;
+                            case SPLIT:
+                                stack.push_back(inst.y);
+                                stack.push_back(inst.x);
+                                break;
+                            case ASSERT:
+                                if (assert_at(inst.x, i, n, prev, cur)) stack.push_back(k + 1);
+                                break;
+                        }
+                    }
+                }
+
+                if (cur < 0) {
+                    return false;
+                }
+                next.clear();
+                for (int k: curr) {
+                    if (class_match(insts[k], (unsigned int) cur)) next.push_back(k + 1);
+                }
+                prev = cur;
+                i += len;
+            }
+        }
+
+    private:
+        typedef enum {
+            CHARS,
+            SPLIT,
+            JMP,
+            ASSERT,
+            MATCH,
+        } op_t;
+
+        struct Inst {
+            op_t op;
+            int x;          /* SPLIT/JMP target, ASSERT kind, CHARS index into classes */
+            int y;          /* SPLIT second target */
+        };
+
+        struct CharClass {
+            ranges_t ranges;
+            bool negate;
+        };
+
+        static bool is_word(int cp) {
+            return cp >= 0 && cp < 0x80 && (isalnum(cp) || cp == '_');
+        }
+
+        static bool assert_at(int kind, int i, int n, int prev, int cur) {
+            switch (kind) {
+                case RegexNode::BEGIN:
+                    return i == 0;
+                case RegexNode::END:
+                    return i == n;
+                case RegexNode::WORD_BOUNDARY:
+                    return is_word(prev) != is_word(cur);
+                default:
+                    return is_word(prev) == is_word(cur);
+            }
+        }
+
+        bool class_match(const Inst &inst, unsigned int cp) const {
+            const CharClass &cls = classes[inst.x];
+            bool in = false;
+            for (const auto &r: cls.ranges) {
+                if (cp >= r.first && cp <= r.second) {
+                    in = true;
+                    break;
+                }
+            }
+            return in != cls.negate;
+        }
+
+        int push(const Inst &inst) {
+            if (insts.size() >= MAX_PROGRAM) {
+                error = "regex is too large";
+                return -1;
+            }
+            insts.push_back(inst);
+            return (int) insts.size() - 1;
+        }
+
+        void emit(const RegexNode &node) {
+            if (error != nullptr) return;
+
+            switch (node.type) {
+                case RegexNode::EMPTY:
+                    break;
+                case RegexNode::CHARS:
+                    classes.push_back({node.ranges, node.negate});
+                    push({CHARS, (int) classes.size() - 1, 0});
+                    break;
+                case RegexNode::CONCAT:
+                    for (const auto &sub: node.subs) emit(sub);
+                    break;
+                case RegexNode::ALTERNATE: {
+                    std::vector<int> jmps;
+                    for (size_t k = 0; k < node.subs.size() && error == nullptr; k++) {
+                        int split = -1;
+                        if (k + 1 < node.subs.size()) split = push({SPLIT, 0, 0});
+                        if (split >= 0) insts[split].x = split + 1;
+                        emit(node.subs[k]);
+                        if (k + 1 < node.subs.size()) {
+                            jmps.push_back(push({JMP, 0, 0}));
+                            if (split >= 0) insts[split].y = (int) insts.size();
+                        }
+                    }
+                    patch(jmps);
+                    break;
+                }
+                case RegexNode::REPEAT: {
+                    for (int k = 0; k < node.min && error == nullptr; k++) emit(node.subs[0]);
+                    if (node.max < 0) {
+                        int split = push({SPLIT, 0, 0});
+                        if (split < 0) break;
+                        insts[split].x = split + 1;
+                        emit(node.subs[0]);
+                        push({JMP, split, 0});
+                        if (error == nullptr) insts[split].y = (int) insts.size();
+                    } else {
+                        // x{min,max}: (max - min) optional copies, each skips to the end
+                        std::vector<int> splits;
+                        for (int k = node.min; k < node.max && error == nullptr; k++) {
+                            int split = push({SPLIT, 0, 0});
+                            if (split < 0) break;
+                            insts[split].x = split + 1;
+                            splits.push_back(split);
+                            emit(node.subs[0]);
+                        }
+                        if (error == nullptr) {
+                            for (int split: splits) insts[split].y = (int) insts.size();
+                        }
+                    }
+                    break;
+                }
+                case RegexNode::ASSERT:
+                    push({ASSERT, node.assertion, 0});
+                    break;
+                case RegexNode::BACKREF:
+                    error = "back-references are not supported";
+                    break;
+                case RegexNode::LOOKAROUND:
+                    error = "lookarounds are not supported";
+                    break;
+            }
+        }
+
+        void patch(const std::vector<int> &jmps) {
+            if (error != nullptr) return;
+            for (int k: jmps) insts[k].x = (int) insts.size();
+        }
+
+        std::vector<Inst> insts;
+        std::vector<CharClass> classes;
+        const char *error;
+    };
+
+    // Rewrite literal leaves into FTS5 terms, literals yielding no usable term become ANY
+    static Query query_terms(const Query &q, const ngram_context_t *opts) {
+        switch (q.op) {
+            case Query::LITERAL: {
+                std::vector<std::string> terms;
+                literal_match_terms(q.literal.data(), (int) q.literal.size(), false, false, opts, terms);
+                Query r;
+                for (const auto &term: terms) {
+                    Query t(term);
+                    r = r.op == Query::ANY ? t : query_combine(Query::AND, r, t);
+                }
+                return r;
+            }
+            case Query::AND:
+            case Query::OR: {
+                Query r = query_terms(q.subs[0], opts);
+                for (size_t k = 1; k < q.subs.size(); k++) {
+                    Query t = query_terms(q.subs[k], opts);
+                    // ANY is absorbing for OR, neutral for AND
+                    if (q.op == Query::OR && (r.op == Query::ANY || t.op == Query::ANY)) return Query();
+                    r = query_combine(q.op, r, t);
+                }
+                return r;
+            }
+            default:
+                return q;
+        }
+    }
+
+    static void query_print(const Query &q, std::string &out) {
+        if (q.op == Query::LITERAL) {
+            out += q.literal;
+            return;
+        }
+        out += "(";
+        for (size_t k = 0; k < q.subs.size(); k++) {
+            if (k != 0) out += q.op == Query::AND ? " AND " : " OR ";
+            query_print(q.subs[k], out);
+        }
+        out += ")";
+    }
+
+    /**
+     * Build an FTS5 MATCH expression selecting a superset of the texts a regex may match
+     *
+     * @expr    where to store the expression, "" if every row is a candidate
+     * @return  false if the regex cannot be parsed
+     */
+    bool regex_match_expr(const char *zPattern, const ngram_context_t *opts, std::string &expr) {
+        CHECK_NOTNULL(zPattern);
+        CHECK_NOTNULL(opts);
+
+        RegexNode node;
+        RegexParser parser(zPattern, (int) strlen(zPattern));
+        if (!parser.parse(node)) {
+            return false;
+        }
+
+        Query q = query_terms(regex_analyze(node).to_match(), opts);
+        expr.clear();
+        if (q.op != Query::ANY) {
+            query_print(q, expr);
+        }
+        return true;
+    }
+}
+
+/**
+ * SQL function ngram_regex_query(pattern, N)
+ *  Return an FTS5 MATCH expression for an ngram table of N-gram selecting candidates of the regex,
+ *  NULL if the regex has no usable literal.
+ */
+static void ngram_regex_query(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_EQ(nVal, 2);
+
+    auto zPattern = (const char *) sqlite3_value_text(apVal[0]);
+    if (zPattern == nullptr) {
+        return;
+    }
+
+    ngram_context_t opts;
+    (void) memset(&opts, 0, sizeof(opts));
+    opts.ngram = sqlite3_value_int(apVal[1]);
+    if (opts.ngram < MIN_GRAM || opts.ngram > MAX_GRAM) {
+        sqlite3_result_error(pCtx, "N is out of range of function " LIBNAME "_regex_query()", -1);
+        return;
+    }
+
+    std::string expr;
+    if (!ngram_tokenizer::regex_match_expr(zPattern, &opts, expr)) {
+        sqlite3_result_error(pCtx, "cannot parse regex", -1);
+    } else if (!expr.empty()) {
+        sqlite3_result_text(pCtx, expr.c_str(), (int) expr.size(), SQLITE_TRANSIENT);
+    }
+}
+
+/*
+** Compiled regex, cached per statement by sqlite3_set_auxdata()
+*/
+struct RegexMatcher {
+    bool literal;           /* Pattern has no metacharacter, use a substring search */
+    std::string needle;
+    ngram_tokenizer::RegexProgram prog;
+};
+
+static void regexMatcherDelete(void *p) {
+    delete (RegexMatcher *) p;
+}
+
+/**
+ * @zErr    where to store the error message if failed
+ */
+static RegexMatcher *regexMatcherCompile(const char *zPattern, int nPattern, const char **zErr) {
+    auto p = new(std::nothrow) RegexMatcher();
+    if (p == nullptr) {
+        *zErr = "out of memory";
+        return nullptr;
+    }
+
+    p->literal = strcspn(zPattern, "\\^$.|?*+()[]{}") == (size_t) nPattern;
+    if (p->literal) {
+        p->needle.assign(zPattern, nPattern);
+        return p;
+    }
+
+    ngram_tokenizer::RegexNode node;
+    ngram_tokenizer::RegexParser parser(zPattern, nPattern);
+    if (!parser.parse(node)) {
+        *zErr = "cannot parse regex";
+    } else {
+        *zErr = p->prog.compile(node);
+    }
+    if (*zErr != nullptr) {
+        LOG(ERROR) << "Cannot compile regex " << zPattern << ": " << *zErr;
+        delete p;
+        return nullptr;
+    }
+    return p;
+}
+
+/**
+ * SQL function ngram_regexp(pattern, text)
+ *  Return 1 if text contains a match of the ECMAScript regex pattern, 0 otherwise.
+ *  Back-references and lookarounds are not supported, thus matching takes linear time in the text length.
+ */
+static void ngram_regexp(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_EQ(nVal, 2);
+
+    auto zText = (const char *) sqlite3_value_text(apVal[1]);
+    int nText = sqlite3_value_bytes(apVal[1]);
+    if (zText == nullptr) {
+        return;
+    }
+
+    auto p = (RegexMatcher *) sqlite3_get_auxdata(pCtx, 0);
+    if (p == nullptr) {
+        auto zPattern = (const char *) sqlite3_value_text(apVal[0]);
+        if (zPattern == nullptr) {
+            return;
+        }
+        const char *zErr;
+        p = regexMatcherCompile(zPattern, sqlite3_value_bytes(apVal[0]), &zErr);
+        if (p == nullptr) {
+            sqlite3_result_error(pCtx, zErr, -1);
+            return;
+        }
+        sqlite3_set_auxdata(pCtx, 0, p, regexMatcherDelete);
+        // sqlite3_set_auxdata() may have destroyed p already(e.g. OOM)
+        p = (RegexMatcher *) sqlite3_get_auxdata(pCtx, 0);
+        if (p == nullptr) {
+            sqlite3_result_error_nomem(pCtx);
+            return;
+        }
+    }
+
+    bool found;
+    if (p->literal) {
+        found = p->needle.empty() || memmem(zText, nText, p->needle.data(), p->needle.size()) != nullptr;
+    } else {
+        found = p->prog.search(zText, nText);
+    }
+    sqlite3_result_int(pCtx, found);
+}
+
+int ngram_regex_init(sqlite3 *db) {
+    int rc = sqlite3_create_function(db, LIBNAME "_regex_query", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                     ngram_regex_query, nullptr, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_regexp", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                     ngram_regexp, nullptr, nullptr);
+    }
+    return rc;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+#include <string>
+
+#include "ngram_context.h"
+
+namespace ngram_tokenizer {
+    bool regex_match_expr(const char *, const ngram_context_t *, std::string &);
+}
+
+int ngram_regex_init(sqlite3 *);
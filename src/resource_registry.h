@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <glog/logging.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ngram_tokenizer {
+    /**
+     * Process-wide registry of reference-counted immutable resources
+     *  Resources are keyed by a canonical string, thus all connections and tables asking for the same key
+     *  share a single instance. The registry is only touched when a tokenizer is created or deleted,
+     *  xTokenize() dereferences the resource directly, so the hot path never takes the lock.
+     *  Resources are created outside the lock(e.g. a large dictionary load), only callers of the same key wait for it.
+     */
+    template<typename T>
+    class ResourceRegistry {
+    public:
+        /**
+         * Get the resource of key, create it by create() if absent
+         *  create() runs without the lock, concurrent callers of the same key wait for it,
+         *  if it failed one of them tries again.
+         *
+         * @return  nullptr if create() failed
+         */
+        template<typename Create>
+        T *acquire(const std::string &key, Create create) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            for (;;) {
+                auto it = entries.find(key);
+                if (it == entries.end()) {
+                    break;
+                }
+                if (it->second.resource != nullptr) {
+                    it->second.refs++;
+                    DLOG(INFO) << "Shared resource '" << key << "' refs: " << it->second.refs;
+                    return it->second.resource;
+                }
+                // Being created by another caller
+                created.wait(lock);
+            }
+
+            // A pending entry(null resource) makes later callers of key wait, it's only erased by its creator
+            entries.emplace(key, entry_t{nullptr, 1});
+            lock.unlock();
+            T *resource = create();
+            lock.lock();
+
+            auto it = entries.find(key);
+            CHECK(it != entries.end());
+            if (resource != nullptr) {
+                it->second.resource = resource;
+                keys.emplace(resource, key);
+                DLOG(INFO) << "Registered resource '" << key << "'";
+            } else {
+                entries.erase(it);
+            }
+            created.notify_all();
+            return resource;
+        }
+
+        /**
+         * Drop a reference of resource, destroy(resource) is called after the last reference is gone
+         */
+        template<typename Destroy>
+        void release(T *resource, Destroy destroy) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto k = keys.find(resource);
+            CHECK(k != keys.end()) << "Releasing an unregistered resource " << resource;
+            auto it = entries.find(k->second);
+            CHECK(it != entries.end());
+            CHECK_EQ(it->second.resource, resource);
+            CHECK_GT(it->second.refs, 0u);
+
+            if (--it->second.refs == 0) {
+                DLOG(INFO) << "Unregistered resource '" << k->second << "'";
+                entries.erase(it);
+                keys.erase(k);
+                destroy(resource);
+            }
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return entries.size();
+        }
+
+    private:
+        typedef struct {
+            T *resource;
+            size_t refs;
+        } entry_t;
+
+        std::mutex mutex;
+        std::condition_variable created;
+        std::unordered_map<std::string, entry_t> entries;
+        std::unordered_map<const T *, std::string> keys;
+    };
+}
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstring>
+#include <glog/logging.h>
+#include <new>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "similarity.h"
+#include "gram_stream.h"
+#include "utils.h"
+
+SQLITE_EXTENSION_INIT3
+
+// Gram set similarity
+//
+//  SELECT ngram_similarity('北京是中国的首都', '北京是中国首度', 2);
+//  SELECT *, ngram_fuzzy_rank(t1, '北京是中国首度') AS score FROM t1 WHERE t1 MATCH '北京 OR 中国 OR 首度' ORDER BY score;
+//
+// Typos are only tolerated within runs of CJK(or other non-ASCII) characters, which are cut into grams,
+//  an ASCII alphanumeric run is a single gram, thus 'iphon' shares nothing with 'iphone'.
+//
+// Grams are hashed to 32-bit values, sorted and deduplicated, the intersection size is then
+//  counted by a 4x4 all-pairs SIMD merge, see:
+//  Schlegel et al., Fast Sorted-Set Intersection using SIMD Instructions, ADMS 2011.
+//  https://highlyscalable.wordpress.com/2012/06/05/fast-intersection-sorted-lists-sse/
+
+namespace ngram_tokenizer {
+    /**
+     * 32-bit FNV-1a hash of a gram
+     */
+    uint32_t gram_hash(const char *p, int n) {
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < n; i++) {
+            h ^= (unsigned char) p[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static int gram_hash_cb(void *pCtx, int tflags, const char *pToken, int nToken, int iStart, int iEnd) {
+        UNUSED(iStart, iEnd);
+        if (!(tflags & FTS5_TOKEN_COLOCATED)) {
+            ((std::vector<uint32_t> *) pCtx)->push_back(gram_hash(pToken, nToken));
+        }
+        return SQLITE_OK;
+    }
+
+    static void sort_unique(std::vector<uint32_t> &v) {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    /**
+     * Generate the sorted gram hash set of a text
+     * @return  SQLITE_OK if success
+     */
+    int gram_hashes(const char *pText, int nText, const ngram_context_t *opts, std::vector<uint32_t> &out) {
+        out.clear();
+        GramStream gs(pText, nText, opts, 0);
+        int rc = gs.run(&out, gram_hash_cb);
+        sort_unique(out);
+        return rc;
+    }
+
+    /**
+     * Count common elements of two sorted sets(no duplicates)
+     */
+    size_t sorted_intersect_count(const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+        size_t i = 0;
+        size_t j = 0;
+        size_t count = 0;
+
+#if defined(__SSE2__)
+        static const uint8_t popcount4[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+        // Compare a 4-element block of a against all rotations of a block of b,
+        //  then advance the block(s) with the smaller maximum.
+        size_t na4 = na & ~(size_t) 3;
+        size_t nb4 = nb & ~(size_t) 3;
+        while (i < na4 && j < nb4) {
+            __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+            __m128i m0 = _mm_cmpeq_epi32(va, vb);
+            __m128i m1 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)));
+            __m128i m2 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128i m3 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)));
+            __m128i m = _mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3));
+            // __builtin_popcount() is a libgcc call without -mpopcnt
+            count += popcount4[_mm_movemask_ps(_mm_castsi128_ps(m))];
+
+            uint32_t amax = a[i + 3];
+            uint32_t bmax = b[j + 3];
+            // Branchless, block maxima of two sets compare unpredictably
+            i += (size_t) (amax <= bmax) << 2;
+            j += (size_t) (bmax <= amax) << 2;
+        }
+#endif
+
+        // Scalar merge for the tails(or the whole sets)
+        while (i < na && j < nb) {
+            if (a[i] < b[j]) {
+                i++;
+            } else if (a[i] > b[j]) {
+                j++;
+            } else {
+                count++;
+                i++;
+                j++;
+            }
+        }
+        return count;
+    }
+}
+
+typedef enum {
+    METRIC_JACCARD,
+    METRIC_DICE,
+} metric_t;
+
+static bool parse_metric(sqlite3_value *pVal, metric_t *metric) {
+    auto z = (const char *) sqlite3_value_text(pVal);
+    if (z == nullptr) return false;
+    if (!sqlite3_stricmp(z, "jaccard")) {
+        *metric = METRIC_JACCARD;
+    } else if (!sqlite3_stricmp(z, "dice")) {
+        *metric = METRIC_DICE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+** Similarity of two sorted gram hash sets, 0.0 if both are empty
+*/
+static double similarity(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b, metric_t metric) {
+    size_t total = a.size() + b.size();
+    if (total == 0) return 0.0;
+
+    auto n = (double) ngram_tokenizer::sorted_intersect_count(a.data(), a.size(), b.data(), b.size());
+    if (metric == METRIC_DICE) {
+        return 2.0 * n / (double) total;
+    }
+    return n / ((double) total - n);
+}
+
+/**
+ * SQL function ngram_similarity(a, b, N[, metric])
+ *  Return the Jaccard(default) or Dice similarity of the N-gram sets of a and b, case insensitive.
+ */
+static void ngram_similarity(sqlite3_context *pCtx, int nVal, sqlite3_value **apVal) {
+    CHECK_GE(nVal, 3);
+
+    auto zA = (const char *) sqlite3_value_text(apVal[0]);
+    int nA = sqlite3_value_bytes(apVal[0]);
+    auto zB = (const char *) sqlite3_value_text(apVal[1]);
+    int nB = sqlite3_value_bytes(apVal[1]);
+    if (zA == nullptr || zB == nullptr) {
+        return;
+    }
+
+    ngram_context_t opts;
+    (void) memset(&opts, 0, sizeof(opts));
+    opts.ngram = sqlite3_value_int(apVal[2]);
+    if (opts.ngram < MIN_GRAM || opts.ngram > MAX_GRAM) {
+        sqlite3_result_error(pCtx, "N is out of range of function " LIBNAME "_similarity()", -1);
+        return;
+    }
+
+    metric_t metric = METRIC_JACCARD;
+    if (nVal > 3 && !parse_metric(apVal[3], &metric)) {
+        sqlite3_result_error(pCtx, "metric must be either 'jaccard' or 'dice'", -1);
+        return;
+    }
+
+    std::vector<uint32_t> a;
+    std::vector<uint32_t> b;
+    int rc = ngram_tokenizer::gram_hashes(zA, nA, &opts, a);
+    if (rc == SQLITE_OK) {
+        rc = ngram_tokenizer::gram_hashes(zB, nB, &opts, b);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(pCtx, rc);
+        return;
+    }
+
+    sqlite3_result_double(pCtx, similarity(a, b, metric));
+}
+
+/*
+** Per-query state of ngram_fuzzy_rank(), cached by xSetAuxdata()
+*/
+struct FuzzyData {
+    metric_t metric;
+    std::vector<uint32_t> aQuery;   /* Sorted gram hashes of the query text */
+    std::vector<uint32_t> aRow;     /* Per-row scratch buffer */
+};
+
+static void fuzzyDataDelete(void *p) {
+    delete (FuzzyData *) p;
+}
+
+static int fuzzyGetData(const Fts5ExtensionApi *pApi, Fts5Context *pFts, int nVal, sqlite3_value **apVal,
+                        FuzzyData **ppData, const char **pzErr) {
+    auto p = (FuzzyData *) pApi->xGetAuxdata(pFts, 0);
+    if (p != nullptr) {
+        *ppData = p;
+        return SQLITE_OK;
+    }
+
+    p = new(std::nothrow) FuzzyData();
+    if (p == nullptr) return SQLITE_NOMEM;
+
+    p->metric = METRIC_JACCARD;
+    if (nVal > 1 && !parse_metric(apVal[1], &p->metric)) {
+        delete p;
+        *pzErr = "metric must be either 'jaccard' or 'dice'";
+        return SQLITE_ERROR;
+    }
+
+    // Tokenized by the table's own tokenizer, so grams agree with the indexed ones
+    auto zQuery = (const char *) sqlite3_value_text(apVal[0]);
+    int nQuery = sqlite3_value_bytes(apVal[0]);
+    int rc = SQLITE_OK;
+    if (zQuery != nullptr) {
+        rc = pApi->xTokenize(pFts, zQuery, nQuery, &p->aQuery, ngram_tokenizer::gram_hash_cb);
+    }
+    if (rc == SQLITE_OK) {
+        ngram_tokenizer::sort_unique(p->aQuery);
+        rc = pApi->xSetAuxdata(pFts, p, fuzzyDataDelete);
+        // xSetAuxdata() invokes the destructor itself on failure
+    } else {
+        delete p;
+    }
+    if (rc == SQLITE_OK) {
+        *ppData = p;
+    }
+    return rc;
+}
+
+/**
+ * FTS5 auxiliary function ngram_fuzzy_rank(tbl, query[, metric])
+ *  Score a row by the gram set similarity between the query text and all its columns.
+ *  Like bm25(), the negated similarity is returned so that "ORDER BY" yields the best matches first.
+ */
+void ngram_fuzzy_rank(
+        const Fts5ExtensionApi *pApi,   /* API offered by current FTS version */
+        Fts5Context *pFts,              /* First arg to pass to pApi functions */
+        sqlite3_context *pCtx,          /* Context for returning result/error */
+        int nVal,                       /* Number of values in apVal[] array */
+        sqlite3_value **apVal           /* Array of trailing arguments */
+) {
+    if (nVal != 1 && nVal != 2) {
+        sqlite3_result_error(pCtx, "wrong number of arguments to function " LIBNAME "_fuzzy_rank()", -1);
+        return;
+    }
+
+    FuzzyData *p = nullptr;
+    const char *zErr = nullptr;
+    int rc = fuzzyGetData(pApi, pFts, nVal, apVal, &p, &zErr);
+    if (zErr != nullptr) {
+        sqlite3_result_error(pCtx, zErr, -1);
+        return;
+    }
+
+    int nCol = pApi->xColumnCount(pFts);
+    if (rc == SQLITE_OK) {
+        p->aRow.clear();
+    }
+    for (int i = 0; rc == SQLITE_OK && i < nCol; i++) {
+        const char *zText = nullptr;
+        int nText = 0;
+        rc = pApi->xColumnText(pFts, i, &zText, &nText);
+        if (rc == SQLITE_OK && zText != nullptr) {
+            rc = pApi->xTokenize(pFts, zText, nText, &p->aRow, ngram_tokenizer::gram_hash_cb);
+        }
+    }
+
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(pCtx, rc);
+        return;
+    }
+
+    ngram_tokenizer::sort_unique(p->aRow);
+    sqlite3_result_double(pCtx, -1.0 * similarity(p->aQuery, p->aRow, p->metric));
+}
+
+int ngram_similarity_init(sqlite3 *db) {
+    int rc = sqlite3_create_function(db, LIBNAME "_similarity", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                     ngram_similarity, nullptr, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, LIBNAME "_similarity", 4, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                     ngram_similarity, nullptr, nullptr);
+    }
+    return rc;
+}
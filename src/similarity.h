@@ -0,0 +1,27 @@
+#pragma once
+
+#include "sqlite/sqlite3ext.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ngram_context.h"
+
+namespace ngram_tokenizer {
+    uint32_t gram_hash(const char *, int);
+
+    int gram_hashes(const char *, int, const ngram_context_t *, std::vector<uint32_t> &);
+
+    size_t sorted_intersect_count(const uint32_t *, size_t, const uint32_t *, size_t);
+}
+
+void ngram_fuzzy_rank(
+        const Fts5ExtensionApi *pApi,   /* API offered by current FTS version */
+        Fts5Context *pFts,              /* First arg to pass to pApi functions */
+        sqlite3_context *pCtx,          /* Context for returning result/error */
+        int nVal,                       /* Number of values in apVal[] array */
+        sqlite3_value **apVal           /* Array of trailing arguments */
+);
+
+int ngram_similarity_init(sqlite3 *);
@@ -1,4 +1,5 @@
 #include "token_vector.h"
+#include "grapheme.h"
 
 #include <cctype>
 #include <glog/logging.h>
@@ -6,6 +7,12 @@
 #include <utility>
 
 namespace ngram_tokenizer {
+    Token::Token() {
+        this->iStart = 0;
+        this->iEnd = 0;
+        this->category = OTHER;
+    }
+
     Token::Token(std::string str, int iStart, int iEnd, token_category_t category) {
         CHECK_GE(iStart, 0);
         CHECK_GE(iEnd, 0);
@@ -33,48 +40,74 @@ namespace ngram_tokenizer {
         return category;
     }
 
-    TokenVector::TokenVector(const char *pText, int nText) {
+    TokenVector::TokenVector(const char *pText, int nText, bool grapheme) {
         CHECK_NOTNULL(pText);
         CHECK_GE(nText, 0);
         this->pText = pText;
         this->nText = nText;
+        this->iOff = 0;
+        this->grapheme = grapheme;
         this->ok = false;
     }
 
     bool TokenVector::tokenize() {
-        int iStart = 0;
-        int iEnd = 0;
+        Token token;
+        int rc;
+
+        while ((rc = next(token)) > 0) {
+            tokens.emplace_back(std::move(token));
+        }
+        if (rc < 0) {
+            return false;
+        }
+        ok = true;
+        return true;
+    }
+
+    /**
+     * Scan the next non-space token from the input text
+     *  it doesn't touch the internal token vector, thus memory usage is independent of the input length.
+     *
+     * @token   where to store the scanned token
+     * @return  1 if a token was scanned, 0 if the input is exhausted, -1 if met non-UTF8 character
+     */
+    int TokenVector::next(Token &token) {
+        while (iOff < nText) {
+            int iStart = iOff;
+            int iEnd = iOff;
 
-        while (iEnd < nText) {
             token_category_t category = token_category(pText[iEnd]);
             if (category == OTHER) {
-                int len = utf8_char_count(pText[iEnd]);
+                int len = grapheme ? grapheme_cluster_length(pText + iEnd, nText - iEnd)
+                                   : utf8_char_count(pText[iEnd]);
                 if (len <= 0) {
                     LOG(ERROR) << "Met non-UTF8 character at index " << iEnd;
-                    return false;
+                    return -1;
                 }
                 iEnd += len;
+                if (iEnd > nText) {
+                    // Certainly not a valid UTF-8 string
+                    return -1;
+                }
             } else {
                 while (++iEnd < nText && token_category(pText[iEnd]) == category) {
                     // continue
                 }
+
+                // Combining marks(e.g. "e\u0301") and keycap sequences attach to the last character of the run
+                if (grapheme && category != SPACE_OR_CONTROL && iEnd < nText && (pText[iEnd] & 0x80)) {
+                    iEnd += grapheme_cluster_length(pText + iEnd - 1, nText - iEnd + 1) - 1;
+                }
             }
 
+            iOff = iEnd;
             if (category != SPACE_OR_CONTROL) {
                 // Will properly null-terminate the resulting std::string
-                std::string s(pText + iStart, iEnd - iStart);
-                tokens.emplace_back(s, iStart, iEnd, category);
+                token = Token(std::string(pText + iStart, iEnd - iStart), iStart, iEnd, category);
+                return 1;
             }
-
-            iStart = iEnd;
         }
-
-        if (iEnd != nText) {
-            // Certainly not a valid UTF-8 string
-            return false;
-        }
-        ok = true;
-        return true;
+        return 0;
     }
 
     // Call only after a successful call of tokenize()
@@ -14,6 +14,8 @@ namespace ngram_tokenizer {
 
     class Token {
     public:
+        Token();
+
         Token(std::string, int, int, token_category_t);
 
         const std::string &get_str() const;
@@ -33,10 +35,12 @@ namespace ngram_tokenizer {
 
     class TokenVector {
     public:
-        TokenVector(const char *, int);
+        TokenVector(const char *, int, bool);
 
         bool tokenize();
 
+        int next(Token &);
+
         const std::vector<Token> &get_tokens() const;
 
     private:
@@ -46,6 +50,8 @@ namespace ngram_tokenizer {
 
         const char *pText;
         int nText;
+        int iOff;   // Scan offset of next()
+        bool grapheme;
         std::vector<Token> tokens;
         bool ok;
     };